@@ -1,5 +1,8 @@
+#ifndef DECLARATION_HPP
+#define DECLARATION_HPP
 
 #include <vector>
+#include "expression.hpp"
 
 class type;
 class expr;
@@ -9,18 +12,52 @@ class decl
 public:
 	decl() { }
 	virtual ~decl() = default;
+
+	virtual long long evaluate() = 0;
 	
 };
 
+// *************************************************************************** //
+// Variable declaration class
+// 
+// Summary:
+//		- Declares a variable with the type of its initializer e.
+//		- The parser resolves the variable to a slot of its value array, so
+//			references to it read values[slot] without looking up the name,
+//			and the declaration keeps only the slot.
+//		- evaluate() stores the value of e in the slot and returns it. The
+//			array grows here rather than when the parser assigns the slot,
+//			so a parser running ahead on another thread never moves it
+//			while an earlier statement is being evaluated.
+//		- memo is given when e may share nodes, as for expr_stmt.
+// 
+// *************************************************************************** //
 class var_decl : public decl
 {
 public:
-	std::string * name;
 	type * t;
 	expr * e;
+	int slot;
+	std::vector<long long> * values;
+	eval_memo * memo;
 
-	var_decl(type * t, std::string * name) : t(t), name(name), e(nullptr) { }
-	var_decl(type * t, std::string * name, expr * e) : t(t), name(name), e(e) { }
+	var_decl(type * t, expr * e, int slot, std::vector<long long> * values, eval_memo * memo = nullptr)
+		: t(t), e(e), slot(slot), values(values), memo(memo) { }
 	~var_decl() { }
+
+	long long evaluate()
+	{
+		if(values->size() <= static_cast<std::size_t>(slot))
+		{
+			values->resize(slot + 1);
+		}
+		if(memo)
+		{
+			memo->begin();
+		}
+		return (* values)[slot] = eval(e, memo);
+	}
 	
 };
+
+#endif
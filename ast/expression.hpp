@@ -2,16 +2,18 @@
 #ifndef EXPRESSION_HPP
 #define EXPRESSION_HPP
 
+#include <algorithm>
+#include <climits>
 #include <exception>
 #include <iostream>
+#include <vector>
 #include "type.hpp"
 #include "com/context.h"
 
-extern context * ctx;
-
 // Expressions classes declarations
 class bool_expr;
 class int_expr;
+class ref_expr;
 class and_expr;
 class or_expr;
 class xor_expr;
@@ -44,13 +46,33 @@ class or_else_expr;
 //			the callee expression's sub expression(s) and returns the
 //			type of it's expression or throws an error if the type check
 //			could not be satisfied. 
+//		- Expressions are allocated from the parser's arena, which owns
+//			them and releases them all at once after each parse.
+//		- The result of check() is cached in t when the expression is
+//			constructed, so checking a parent only reads the cached types
+//			of its sub expressions instead of re-checking their subtrees.
+//		- When the parser shares identical subtrees (see node_factory), a
+//			node handed out more than once is given a memo slot so one
+//			evaluation computes it only once.
+//		- size counts the nodes of the subtree, so an evaluator can tell a
+//			large subtree from a small one without walking it.
 // 
 // *************************************************************************** //
 class expr
 {
 public:
+	// Type of this expression, resolved once at construction
+	type * t;
+
+	// Index of this node in an eval_memo if it is shared, -1 otherwise
+	int memo;
+
+	// Number of nodes in this subtree, set at construction
+	// A shared node counts once per use, saturating at UINT_MAX
+	unsigned size;
+
 	// Default Constructor and Destructor
-	expr() { }
+	expr() : t(nullptr), memo(-1), size(1) { }
 	virtual ~expr() = default;
 
 	// Visitor class declaration
@@ -59,6 +81,14 @@ public:
 	// Pure virtual functions
 	virtual void accept(visitor &) = 0;
 	virtual type * check() = 0;
+
+protected:
+	// Size of a node over sub expressions of the given sizes
+	static unsigned weigh(unsigned a, unsigned b = 0, unsigned c = 0)
+	{
+		unsigned long long n = 1ull + a + b + c;
+		return n > UINT_MAX ? UINT_MAX : static_cast<unsigned>(n);
+	}
 };
 
 // *************************************************************************** //
@@ -76,6 +106,7 @@ public:
 	// One for each type of expression
 	virtual void visit(bool_expr *) = 0;
 	virtual void visit(int_expr *) = 0;
+	virtual void visit(ref_expr *) = 0;
 	virtual void visit(and_expr *) = 0;
 	virtual void visit(or_expr *) = 0;
 	virtual void visit(xor_expr *) = 0;
@@ -112,12 +143,12 @@ public:
 	bool val;
 
 	// Contstructor with initializer list
-	bool_expr(bool _val) : val(_val) { }
+	bool_expr(bool _val) : val(_val) { t = check(); }
 	~bool_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
-	type * check() { return & ctx->bool_type; }
+	type * check() { return & types().bool_type; }
 };
 
 // *************************************************************************** //
@@ -132,15 +163,55 @@ class int_expr : public expr
 {
 public:
 	// Literal integer value
-	int val;
+	long long val;
 
 	// Contstructor with initializer list
-	int_expr(int _val) : val(_val) { }
+	int_expr(long long _val) : val(_val) { t = check(); }
 	~int_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }	
-	type * check() { return & ctx->int_type; }
+	type * check() { return & types().int_type; }
+};
+
+// *************************************************************************** //
+// Reference expression class
+// 
+// Summary:
+//		- Expression that reads the value held in a slot of a value array,
+//			such as an input column or a variable.
+//		- Constuction of this class takes the type of the slot, its index
+//			and the array it is read from.
+// 		- This expression is of the slot's type, which must be the bool_type
+//			or the int_type.
+// 
+// *************************************************************************** //
+class ref_expr : public expr
+{
+public:
+	// Type of the slot
+	type * declared;
+
+	// Index of the slot and the array holding its value
+	int slot;
+	const std::vector<long long> * values;
+
+	// Contstructor with initializer list
+	ref_expr(type * declared, int slot, const std::vector<long long> * values)
+		: declared(declared), slot(slot), values(values) { t = check(); }
+	~ref_expr() { }
+
+	// Inherited virtual function definitions
+	void accept(visitor & v) { return v.visit(this); }
+	type * check()
+	{
+		if(declared == & types().bool_type || declared == & types().int_type)
+		{
+			return declared;
+		}
+
+		throw std::exception("ref_expr slot must be of bool_type or int_type");
+	}
 };
 
 // *************************************************************************** //
@@ -165,27 +236,23 @@ public:
 	// Contstructor with initializer list
 	and_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~and_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~and_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->bool_type && e2->check() == & ctx->bool_type)
+		if(e1->t == & types().bool_type && e2->t == & types().bool_type)
 		{
 			// Return the type of this expression
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("and_expr inner expressions must be of bool_type");
@@ -214,26 +281,22 @@ public:
 	// Contstructor with initializer list
 	or_expr(expr * e1, expr * e2) : e1(e1), e2(e2)	
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~or_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~or_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->bool_type && e2->check() == & ctx->bool_type)
+		if(e1->t == & types().bool_type && e2->t == & types().bool_type)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("or_expr inner expressions must be of bool_type");
@@ -262,26 +325,22 @@ public:
 	// Contstructor with initializer list
 	xor_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~xor_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~xor_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->bool_type && e2->check() == & ctx->bool_type)
+		if(e1->t == & types().bool_type && e2->t == & types().bool_type)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("xor_expr inner expressions must be of bool_type");
@@ -309,25 +368,22 @@ public:
 	// Contstructor with initializer list
 	not_expr(expr * e) : e(e) 
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e->size);
 	}
 
 	// Destructor
-	~not_expr()
-	{
-		// Delete sub expression pointer
-		delete e;
-	}
+	~not_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e->check() == & ctx->bool_type)
+		if(e->t == & types().bool_type)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("not_expr inner expression must be of bool_type");
@@ -359,33 +415,28 @@ public:
 	// Contstructor with initializer list
 	cond_expr(expr * e1, expr * e2, expr * e3) : e1(e1), e2(e2), e3(e3)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size, e3->size);
 	}
 
 	// Destructor
-	~cond_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-		delete e3;
-	}
+	~cond_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }	
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() != & ctx->bool_type)
+		if(e1->t != & types().bool_type)
 		{
 			throw std::exception("cond_expr first expression must be of bool_type");
 		}
 
 		// Hold onto the type of e2
 		// If it matches the type of e3 then return it
-		type * r = e2->check();
-		if(r != e3->check())
+		type * r = e2->t;
+		if(r != e3->t)
 		{
 			throw std::exception("cond_expr second expression and third expression must be of identical type");			
 		}
@@ -416,26 +467,22 @@ public:
 	// Contstructor with initializer list
 	equal_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~equal_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~equal_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }	
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == e2->check())
+		if(e1->t == e2->t)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("equal_expr inner expressions must be of identical type");
@@ -464,26 +511,22 @@ public:
 	// Contstructor with initializer list
 	not_equal_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~not_equal_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~not_equal_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == e2->check())
+		if(e1->t == e2->t)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("not_equal_expr inner expressions must be of identical type");
@@ -512,26 +555,22 @@ public:
 	// Contstructor with initializer list
 	less_than_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~less_than_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~less_than_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->int_type && e2->check() == & ctx->int_type)
+		if(e1->t == & types().int_type && e2->t == & types().int_type)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("less_than_expr inner expressions must be of int_type");
@@ -562,26 +601,22 @@ public:
 	// Contstructor with initializer list
 	greater_than_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~greater_than_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~greater_than_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->int_type && e2->check() == & ctx->int_type)
+		if(e1->t == & types().int_type && e2->t == & types().int_type)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("greater_than_expr inner expressions must be of int_type");
@@ -610,26 +645,22 @@ public:
 	// Contstructor with initializer list
 	less_than_eq_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~less_than_eq_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~less_than_eq_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->int_type && e2->check() == & ctx->int_type)
+		if(e1->t == & types().int_type && e2->t == & types().int_type)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("less_than_eq_expr inner expressions must be of int_type");
@@ -658,26 +689,22 @@ public:
 	// Contstructor with initializer list
 	greater_than_eq_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~greater_than_eq_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~greater_than_eq_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->int_type && e2->check() == & ctx->int_type)
+		if(e1->t == & types().int_type && e2->t == & types().int_type)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("greater_than_eq_expr inner expressions must be of int_type");
@@ -706,26 +733,22 @@ public:
 	// Contstructor with initializer list
 	add_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~add_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~add_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->int_type && e2->check() == & ctx->int_type)
+		if(e1->t == & types().int_type && e2->t == & types().int_type)
 		{
-			return & ctx->int_type;
+			return & types().int_type;
 		}
 
 		throw std::exception("add_expr inner expressions must be of int_type");
@@ -754,26 +777,22 @@ public:
 	// Contstructor with initializer list
 	sub_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~sub_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~sub_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->int_type && e2->check() == & ctx->int_type)
+		if(e1->t == & types().int_type && e2->t == & types().int_type)
 		{
-			return & ctx->int_type;
+			return & types().int_type;
 		}
 
 		throw std::exception("sub_expr inner expressions must be of int_type");
@@ -802,26 +821,22 @@ public:
 	// Contstructor with initializer list
 	multi_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~multi_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~multi_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->int_type && e2->check() == & ctx->int_type)
+		if(e1->t == & types().int_type && e2->t == & types().int_type)
 		{
-			return & ctx->int_type;
+			return & types().int_type;
 		}
 
 		throw std::exception("multi_expr inner expressions must be of int_type");
@@ -850,26 +865,22 @@ public:
 	// Contstructor with initializer list
 	div_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~div_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~div_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->int_type && e2->check() == & ctx->int_type)
+		if(e1->t == & types().int_type && e2->t == & types().int_type)
 		{
-			return & ctx->int_type;
+			return & types().int_type;
 		}
 
 		throw std::exception("div_expr inner expressions must be of int_type");
@@ -898,26 +909,22 @@ public:
 	// Contstructor with initializer list
 	rem_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 
 	// Destructor
-	~rem_expr()
-	{
-		// Delete sub expression pointers
-		delete e1;
-		delete e2;
-	}
+	~rem_expr() { }
 	
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->int_type && e2->check() == & ctx->int_type)
+		if(e1->t == & types().int_type && e2->t == & types().int_type)
 		{
-			return & ctx->int_type;
+			return & types().int_type;
 		}
 
 		throw std::exception("rem_expr inner expressions must be of int_type");
@@ -945,25 +952,22 @@ public:
 	// Contstructor with initializer list
 	neg_expr(expr * e) : e(e)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e->size);
 	}
 	
 	// Destructor
-	~neg_expr()
-	{
-		// Delete sub expression pointer
-		delete e;
-	}
+	~neg_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }	
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e->check() == & ctx->int_type)
+		if(e->t == & types().int_type)
 		{
-			return & ctx->int_type;
+			return & types().int_type;
 		}
 
 		throw std::exception("neg_expr inner expression must be of int_type");
@@ -992,26 +996,22 @@ public:
 	// Contstructor with initializer list
 	and_then_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 	
 	// Destructor
-	~and_then_expr()
-	{
-		// Delete sub expression pointer
-		delete e1;
-		delete e2;
-	}
+	~and_then_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }	
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		if(e1->check() == & ctx->bool_type && e2->check() == & ctx->bool_type)
+		if(e1->t == & types().bool_type && e2->t == & types().bool_type)
 		{
-			return & ctx->bool_type;
+			return & types().bool_type;
 		}
 
 		throw std::exception("and_then_expr inner expressions must be of bool_type");
@@ -1027,7 +1027,7 @@ public:
 //		- e1 and e2 must be of identical type.
 // 		- This expression is of the same type as e1 and e2.
 //		- The evaluation of this expression is equal to e1 by 
-//			default or else e2.
+//			default (when e1 is non zero) or else e2.
 // 
 // *************************************************************************** //
 class or_else_expr : public expr
@@ -1040,25 +1040,21 @@ public:
 	// Contstructor with initializer list
 	or_else_expr(expr * e1, expr * e2) : e1(e1), e2(e2)
 	{
-		// Type check before construction
-		check();
+		// Type check before construction and cache the result
+		t = check();
+		size = weigh(e1->size, e2->size);
 	}
 	
 	// Destructor
-	~or_else_expr()
-	{
-		// Delete sub expression pointer
-		delete e1;
-		delete e2;
-	}
+	~or_else_expr() { }
 
 	// Inherited virtual function definitions
 	void accept(visitor & v) { return v.visit(this); }	
 	type * check()
 	{
 		// Verify appropriate sub expression typing
-		type * r = e1->check();
-		if(r == e2->check())
+		type * r = e1->t;
+		if(r == e2->t)
 		{
 			return r;
 		}
@@ -1075,9 +1071,81 @@ public:
 // Converts the boolean literal argument into an integer literal
 int convert(bool val) { return val ? 1 : 0; }
 
+// Division helper functions
+// Divide the first argument by the second, throwing instead of letting the
+// hardware trap: on a zero divisor, and on LLONG_MIN / -1 which overflows
+void check_division(long long a, long long b)
+{
+	if(b == 0)
+	{
+		throw std::exception("Division by zero");
+	}
+	if(a == LLONG_MIN && b == -1)
+	{
+		throw std::exception("Division overflow");
+	}
+}
+
+long long int_div(long long a, long long b) { check_division(a, b); return a / b; }
+long long int_rem(long long a, long long b) { check_division(a, b); return a % b; }
+
+// *************************************************************************** //
+// Evaluation memo for shared nodes
+// 
+// Summary:
+//		- Holds the value of each shared node computed during the current
+//			evaluation, indexed by the node's memo slot.
+//		- A slot is valid only while its stamp matches the current one, so
+//			starting a new evaluation is a single increment instead of a
+//			clear of every slot.
+// 
+// *************************************************************************** //
+class eval_memo
+{
+private:
+	std::vector<long long> values;
+	std::vector<unsigned> stamps;
+	unsigned stamp;
+
+public:
+	eval_memo() : stamp(0) { }
+
+	// Invalidates every slot before evaluating another statement
+	void begin()
+	{
+		if(++stamp == 0)
+		{
+			std::fill(stamps.begin(), stamps.end(), 0);
+			stamp = 1;
+		}
+	}
+
+	bool find(int slot, long long & val) const
+	{
+		if(slot >= static_cast<int>(stamps.size()) || stamps[slot] != stamp)
+		{
+			return false;
+		}
+		val = values[slot];
+		return true;
+	}
+
+	void store(int slot, long long val)
+	{
+		if(slot >= static_cast<int>(stamps.size()))
+		{
+			values.resize(slot + 1);
+			stamps.resize(slot + 1, 0);
+		}
+		values[slot] = val;
+		stamps[slot] = stamp;
+	}
+};
+
 // Evaluation helper function
 // Evaluates the expression argument
-int eval(expr * e)
+// When a memo is given, shared nodes are evaluated once and then read back
+long long eval(expr * e, eval_memo * m)
 {
 	// Derived expression visitor class
 	// Overloaded visit function for each of the expression types
@@ -1085,39 +1153,57 @@ int eval(expr * e)
 	class v : public expr::visitor
 	{
 	public:
-		int val;
+		eval_memo * m;
+		long long val;
+		v(eval_memo * m) : m(m) { }
 		void visit(bool_expr * e) { val = convert(e->val); }
 		void visit(int_expr * e) { val = e->val; }
-		void visit(and_expr * e) { val = convert(eval(e->e1) & eval(e->e2)); }
-		void visit(or_expr * e) { val = convert(eval(e->e1) | eval(e->e2)); }
-		void visit(xor_expr * e) { val = convert(eval(e->e1) ^ eval(e->e2)); }
-		void visit(not_expr * e) { val = convert(!eval(e->e)); }
-		void visit(cond_expr * e) { val = (eval(e->e1) ? eval(e->e2) : eval(e->e3)); }
-		void visit(equal_expr * e) { val = convert(eval(e->e1) == eval(e->e2)); }
-		void visit(not_equal_expr * e) { val = convert(eval(e->e1) != eval(e->e2)); }
-		void visit(less_than_expr * e) { val = convert(eval(e->e1) < eval(e->e2)); }
-		void visit(greater_than_expr * e) { val = convert(eval(e->e1) > eval(e->e2)); }
-		void visit(less_than_eq_expr * e) { val = convert(eval(e->e1) <= eval(e->e2));}
-		void visit(greater_than_eq_expr * e) { val = convert(eval(e->e1) >= eval(e->e2)); }
-		void visit(add_expr * e) { val = eval(e->e1) + eval(e->e2); }
-		void visit(sub_expr * e) { val = eval(e->e1) - eval(e->e2); }
-		void visit(multi_expr * e) { val = eval(e->e1) * eval(e->e2); }
-		void visit(div_expr * e) { val = eval(e->e1) / eval(e->e2); }
-		void visit(rem_expr * e) { val = eval(e->e1) % eval(e->e2); }
-		void visit(neg_expr * e) { val = -eval(e->e); }
-		void visit(and_then_expr * e) { val = eval(e->e1) == 1 ? eval(e->e2) : 0; }
-		void visit(or_else_expr * e) { val = 1 == 1 ? eval(e->e1) : eval(e->e2); }
+		void visit(ref_expr * e) { val = (* e->values)[e->slot]; }
+		void visit(and_expr * e) { val = convert(eval(e->e1, m) & eval(e->e2, m)); }
+		void visit(or_expr * e) { val = convert(eval(e->e1, m) | eval(e->e2, m)); }
+		void visit(xor_expr * e) { val = convert(eval(e->e1, m) ^ eval(e->e2, m)); }
+		void visit(not_expr * e) { val = convert(!eval(e->e, m)); }
+		void visit(cond_expr * e) { val = (eval(e->e1, m) ? eval(e->e2, m) : eval(e->e3, m)); }
+		void visit(equal_expr * e) { val = convert(eval(e->e1, m) == eval(e->e2, m)); }
+		void visit(not_equal_expr * e) { val = convert(eval(e->e1, m) != eval(e->e2, m)); }
+		void visit(less_than_expr * e) { val = convert(eval(e->e1, m) < eval(e->e2, m)); }
+		void visit(greater_than_expr * e) { val = convert(eval(e->e1, m) > eval(e->e2, m)); }
+		void visit(less_than_eq_expr * e) { val = convert(eval(e->e1, m) <= eval(e->e2, m));}
+		void visit(greater_than_eq_expr * e) { val = convert(eval(e->e1, m) >= eval(e->e2, m)); }
+		void visit(add_expr * e) { val = eval(e->e1, m) + eval(e->e2, m); }
+		void visit(sub_expr * e) { val = eval(e->e1, m) - eval(e->e2, m); }
+		void visit(multi_expr * e) { val = eval(e->e1, m) * eval(e->e2, m); }
+		void visit(div_expr * e) { val = eval(e->e1, m); val = int_div(val, eval(e->e2, m)); }
+		void visit(rem_expr * e) { val = eval(e->e1, m); val = int_rem(val, eval(e->e2, m)); }
+		void visit(neg_expr * e) { val = -eval(e->e, m); }
+		void visit(and_then_expr * e) { val = eval(e->e1, m) == 1 ? eval(e->e2, m) : 0; }
+		void visit(or_else_expr * e) { val = eval(e->e1, m); if(val == 0) { val = eval(e->e2, m); } }
 	};
 
+	// A shared node already computed in this evaluation
+	long long val;
+	if(m && e->memo >= 0 && m->find(e->memo, val))
+	{
+		return val;
+	}
+
 	// Create v (derived from visitor)
-	v vis;
+	v vis(m);
 
 	// Call the expression argument's accept function with the (v) argument
 	e->accept(vis);
 
+	if(m && e->memo >= 0)
+	{
+		m->store(e->memo, vis.val);
+	}
+
 	// Return the value of v
 	// This is set in the corrsponding overloaded visit function defined in class v
 	return vis.val;
 }
 
+// Evaluates a tree without memoizing
+long long eval(expr * e) { return eval(e, nullptr); }
+
 #endif
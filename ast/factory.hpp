@@ -0,0 +1,115 @@
+
+#ifndef FACTORY_HPP
+#define FACTORY_HPP
+
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include "expression.hpp"
+#include "com/arena.hpp"
+
+// *************************************************************************** //
+// Node factory class
+//
+// Summary:
+//		- Hash-conses expressions: asking for a node with the same kind,
+//			children and literal value as an existing one returns that
+//			node instead of allocating a new one, so the parse of an
+//			expression becomes a DAG.
+//		- Children are themselves hash-consed, so comparing their pointers
+//			is the same as comparing the subtrees structurally.
+//		- A node returned more than once is given a memo slot, which lets
+//			eval() compute it once per evaluation.
+//		- Nodes are allocated from the given arena, so clear() must be
+//			called whenever that arena is reset.
+//
+// *************************************************************************** //
+class node_factory
+{
+private:
+	struct key
+	{
+		const void * kind;
+		expr * e[3];
+		long long val;
+
+		bool operator==(const key & k) const
+		{
+			return kind == k.kind && e[0] == k.e[0] && e[1] == k.e[1] && e[2] == k.e[2] && val == k.val;
+		}
+	};
+
+	struct key_hash
+	{
+		std::size_t operator()(const key & k) const
+		{
+			std::size_t h = std::hash<const void *>()(k.kind);
+			h = h * 31 + std::hash<expr *>()(k.e[0]);
+			h = h * 31 + std::hash<expr *>()(k.e[1]);
+			h = h * 31 + std::hash<expr *>()(k.e[2]);
+			return h * 31 + std::hash<long long>()(k.val);
+		}
+	};
+
+	arena & arn;
+	std::unordered_map<key, expr *, key_hash> nodes;
+	int shared;
+
+	// One address per node type identifies its kind in a key
+	template<typename T>
+	static const void * kind()
+	{
+		static const char id = 0;
+		return & id;
+	}
+
+	static void add(key & k, int & n, expr * e) { k.e[n++] = e; }
+	static void add(key & k, int &, long long val) { k.val = val; }
+	static void add(key & k, int &, bool val) { k.val = val; }
+	static void add(key & k, int &, int slot) { k.val = slot; }
+
+	// The type and array of a ref_expr follow from its slot
+	static void add(key &, int &, const void *) { }
+
+public:
+	node_factory(arena & arn) : arn(arn), shared(0) { }
+
+	node_factory(const node_factory &) = delete;
+	node_factory & operator=(const node_factory &) = delete;
+
+	// Returns the node T(args...), reusing an identical one if it exists
+	template<typename T, typename... Args>
+	T * make(Args... args)
+	{
+		key k = { kind<T>(), { nullptr, nullptr, nullptr }, 0 };
+		int n = 0;
+		(add(k, n, args), ...);
+
+		auto it = nodes.find(k);
+		if(it != nodes.end())
+		{
+			if(it->second->memo < 0)
+			{
+				it->second->memo = shared++;
+			}
+			return static_cast<T *>(it->second);
+		}
+
+		T * e = arn.make<T>(args...);
+		nodes.emplace(k, e);
+		return e;
+	}
+
+	// Forgets every node, to be called when their arena is reset
+	void clear()
+	{
+		nodes.clear();
+		shared = 0;
+	}
+
+	// Number of distinct nodes and of nodes handed out more than once
+	std::size_t size() const { return nodes.size(); }
+	int shared_count() const { return shared; }
+};
+
+#endif
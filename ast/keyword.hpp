@@ -1,20 +1,94 @@
+#ifndef KEYWORD_HPP
+#define KEYWORD_HPP
 
-#include <unordered_map>
-#include <string>
+#include <string_view>
+#include "token.hpp"
 
-class keyword_table : public std::unordered_map<std::string, token_kind>
+// *************************************************************************** //
+// Keyword table
+// 
+// Summary:
+//		- A perfect hash table of the keywords, built at compile time.
+//		- A word hashes on its length and its first and last characters.
+//			The constructor searches for a multiplier under which no two
+//			keywords collide, so find() is one hash, one load and one
+//			string compare.
+//		- Register keywords in keyword_list. Adding a keyword that cannot be
+//			placed without a collision fails to compile.
+// 
+// *************************************************************************** //
+struct keyword
 {
+	std::string_view word;
+	token_kind kind = eof;
+	long long val = 0;
+};
+
+constexpr keyword keyword_list[] =
+{
+	{ "bool", bool_keyword, 0 },
+	{ "false", bool_literal, 0 },
+	{ "int", int_keyword, 0 },
+	{ "true", bool_literal, 1 },
+	{ "var", variable_literal, 0 },
+};
+
+class keyword_table
+{
+private:
+	static constexpr unsigned size = 16;
+
+	keyword slots[size];
+	unsigned seed;
+
+	static constexpr unsigned hash(std::string_view s, unsigned seed)
+	{
+		return (static_cast<unsigned char>(s[0]) * seed + static_cast<unsigned char>(s[s.size() - 1]) + static_cast<unsigned>(s.size())) % size;
+	}
+
+	// Places every keyword with the given seed, false on a collision
+	constexpr bool place(unsigned s)
+	{
+		for(keyword & k : slots)
+		{
+			k = keyword();
+		}
+		for(const keyword & k : keyword_list)
+		{
+			keyword & slot = slots[hash(k.word, s)];
+			if(!slot.word.empty())
+			{
+				return false;
+			}
+			slot = k;
+		}
+		return true;
+	}
+
 public:
-	keyword_table()
+	constexpr keyword_table() : seed(0)
 	{
-		// Register keywords here
-		// insert({ "bool", bool_literal });
-		insert({ "false", bool_literal });
-		// insert({ "int", int_literal });
-		insert({ "true", bool_literal });
-		insert({ "var", variable_literal });
+		for(unsigned s = 1; s < 256; ++s)
+		{
+			if(place(s))
+			{
+				seed = s;
+				return;
+			}
+		}
 	}
 
-	~keyword_table() { }
-	
+	constexpr bool valid() const { return seed != 0; }
+
+	// Returns the keyword s, or nullptr if s is not a keyword
+	constexpr const keyword * find(std::string_view s) const
+	{
+		const keyword & k = slots[hash(s, seed)];
+		return k.word == s ? & k : nullptr;
+	}
 };
+
+constexpr keyword_table keywords;
+static_assert(keywords.valid(), "keywords collide in keyword_table");
+
+#endif
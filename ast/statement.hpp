@@ -1,31 +1,68 @@
+#ifndef STATEMENT_HPP
+#define STATEMENT_HPP
+
 
 // # include "expression.hpp"
 // # include "declaration.hpp"
+#include "com/trace.hpp"
+#include "declaration.hpp"
+#include "fork.hpp"
 
 class expr;
 class decl;
+class expr_stmt;
+class decl_stmt;
 
 class stmt
 {
 public:
 	stmt() { }
 	virtual ~stmt() = default;
-	virtual int evaluate() = 0;
+
+	// Visitor class declaration
+	class visitor;
+
+	virtual void accept(visitor &) = 0;
+	virtual long long evaluate() = 0;
 	
 };
 
+// Statement visitor class
+// One visit function for each type of statement
+class stmt::visitor
+{
+public:
+	virtual void visit(expr_stmt *) = 0;
+	virtual void visit(decl_stmt *) = 0;
+};
+
 class expr_stmt : public stmt
 {
 public:
 	expr * e;
+	eval_memo * memo;
+	fork_evaluator * fork;
 
-	expr_stmt(expr * e) : e(e) { }
+	// memo is given when e may share nodes and fork when large expressions
+	// may be evaluated on several threads
+	expr_stmt(expr * e, eval_memo * memo = nullptr, fork_evaluator * fork = nullptr)
+		: e(e), memo(memo), fork(fork) { }
 	~expr_stmt() { }
 
-	int evaluate()
+	void accept(visitor & v) { return v.visit(this); }
+
+	long long evaluate()
 	{
-		std::cout << "evaluate expr stmt" << std::endl;
-		return eval(e);
+		trace("evaluate expr stmt");
+		if(memo)
+		{
+			memo->begin();
+		}
+		else if(fork && e->size >= fork->cutoff())
+		{
+			return fork->eval(e);
+		}
+		return eval(e, memo);
 	}
 	
 };
@@ -38,10 +75,14 @@ public:
 	decl_stmt(decl * d) : d(d) { }
 	~decl_stmt() { }
 
-	int evaluate()
+	void accept(visitor & v) { return v.visit(this); }
+
+	long long evaluate()
 	{
-		std::cout << "evaluate decl stmt" << std::endl;
-		return 0;
+		trace("evaluate decl stmt");
+		return d->evaluate();
 	}	
 
 };
+
+#endif
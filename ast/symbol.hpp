@@ -1,13 +1,69 @@
 
-#include <unordered_map>
-#include <string>
+#ifndef SYMBOL_HPP
+#define SYMBOL_HPP
 
-class decl;
+#include <vector>
 
-class symbol_table : public std::unordered_map<std::string, decl *>
+class type;
+
+// A declared variable, its type and the index of its slot in the parser's
+// value array
+struct symbol
+{
+	type * t;
+	int slot;
+};
+
+// What a declaration changed the binding of name from and to, so an edited
+// program can be parsed again from the middle
+struct binding
+{
+	unsigned name;
+	symbol before;
+	symbol after;
+};
+
+// Variables indexed by the interned id of their name, so a lookup is an
+// index instead of a hash of the name
+// Names are only looked up while parsing, references are bound to slots
+class symbol_table
 {
+private:
+	std::vector<symbol> symbols;
+
 public:
 	symbol_table() { }
 	~symbol_table() { }
+
+	// Returns the variable named id, or nullptr if it is not declared
+	symbol * find(unsigned id)
+	{
+		return id < symbols.size() && symbols[id].t ? & symbols[id] : nullptr;
+	}
+
+	// Returns the entry of id, which has no type until it is declared
+	symbol & operator[](unsigned id)
+	{
+		if(id >= symbols.size())
+		{
+			symbols.resize(id + 1, symbol{ nullptr, 0 });
+		}
+		return symbols[id];
+	}
+
+	// Calls f with every declared variable
+	template<typename F>
+	void each(F f)
+	{
+		for(symbol & s : symbols)
+		{
+			if(s.t)
+			{
+				f(s);
+			}
+		}
+	}
 	
 };
+
+#endif
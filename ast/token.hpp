@@ -41,6 +41,10 @@ enum token_kind
 	comment_literal,
 	variable_literal,
 
+	// type keywords
+	bool_keyword,
+	int_keyword,
+
 	identifier
 };
 
@@ -82,161 +86,36 @@ const char * token_kind_strs[]
 	"HEX_LITERAL",
 	"COMMENT_LITERAL",
 	"VARIABLE_LITERAL",
+
+	// type keywords
+	"BOOL_KEYWORD",
+	"INT_KEYWORD",
+
 	"IDENTIFIER"
 };
 
-class op_token;
-class bool_token;
-class int_token;
-class binary_token;
-class hex_token;
-class comment_token;
-class id_token;
-class var_token;
-
+// *************************************************************************** //
+// Token class
+// 
+// Summary:
+//		- Plain value type produced by the lexer. Tokens are stored
+//			contiguously in a std::vector<token> and copied freely.
+//		- val holds the payload of bool, int, binary and hex literals, and
+//			the interned id of identifiers.
+//		- pos and len are the token's span in the lexed source. The text of
+//			identifiers and comments is read from the source through it.
+// 
+// *************************************************************************** //
 class token
 {
 public:
 	token_kind kind;
+	long long val;
+	unsigned pos;
+	unsigned len;
 
-	token() { }
-	virtual ~token() = default;
-
-	// Visitor class declaration
-	class visitor;
-
-	// Pure virtual functions
-	virtual void accept(visitor &) = 0;
-	
-};
-
-class token::visitor
-{
-public:
-	virtual void visit(op_token *) = 0;
-	virtual void visit(bool_token *) = 0;
-	virtual void visit(int_token *) = 0;
-	virtual void visit(binary_token *) = 0;
-	virtual void visit(hex_token *) = 0;
-	virtual void visit(comment_token *) = 0;
-	virtual void visit(id_token *) = 0;
-	virtual void visit(var_token *) = 0;
-};
-
-class op_token : public token
-{
-public:
-	op_token(token_kind tk)
-	{
-		kind = tk;
-	}
-	~op_token() { }
-
-	void accept(visitor & v) { return v.visit(this); }
-	
-};
-
-class bool_token : public token
-{
-public:
-	bool val;
-
-	bool_token(bool b) : val(b)
-	{
-		kind = bool_literal;
-	}
-	~bool_token() { }
-
-	void accept(visitor & v) { return v.visit(this); }
-	
-};
-
-class int_token : public token
-{
-public:
-	const int val;
-
-	int_token(int i) : val(i)
-	{
-		kind = int_literal;
-	}
-	~int_token() { }
-
-	void accept(visitor & v) { return v.visit(this); }
-	
-};
-
-class binary_token : public token
-{
-public:
-	const int val;
-
-	binary_token(int i) : val(i)
-	{
-		kind = binary_literal;
-	}
-	~binary_token() { }
-
-	void accept(visitor & v) { return v.visit(this); }
-	
-};
-
-class hex_token : public token
-{
-public:
-	const int val;
-
-	hex_token(int i) : val(i)
-	{
-		kind = hex_literal;
-	}
-	~hex_token() { }
-
-	void accept(visitor & v) { return v.visit(this); }
-	
-};
-
-class comment_token : public token
-{
-public:
-	std::string val;
-
-	comment_token(std::string s) : val(s) 
-	{
-		kind = comment_literal;
-	}
-	~comment_token() { }
-
-	void accept(visitor & v) { return v.visit(this); }
-	
-};
-
-class id_token : public token
-{
-public:
-	std::string val;
-
-	id_token(std::string s) : val(s)
-	{
-		kind = identifier;
-	}
-	~id_token() { }
-
-	void accept(visitor & v) { return v.visit(this); }
-	
-};
-
-class var_token : public token
-{
-public:
-	var_token()
-	{
-		kind = variable_literal;
-	}
-	~var_token() { }
-
-	void accept(visitor & v) { return v.visit(this); }
-	
+	token() = default;
+	token(token_kind kind, unsigned pos, unsigned len, long long val = 0) : kind(kind), val(val), pos(pos), len(len) { }
 };
 
 #endif
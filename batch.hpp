@@ -0,0 +1,369 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+# include <algorithm>
+# include <cstddef>
+# include <cstring>
+# include <initializer_list>
+# include <vector>
+
+# include "ast/expression.hpp"
+# include "com/simd.hpp"
+
+// *************************************************************************** //
+// Batch evaluation
+//
+// Summary:
+//		- eval_batch() evaluates one expression for many rows of inputs. A
+//			ref_expr with slot i reads row r from columns[i][r]. Columns
+//			of bool slots must hold 0 or 1.
+//		- Rows are evaluated a chunk at a time. Within a chunk each node
+//			is computed for every row before its parent, so a node costs
+//			one virtual call per chunk instead of one per row, and its
+//			loop runs over contiguous columns.
+//		- add, sub, the bitwise operators and the comparisons run on 64 bit
+//			lanes with SSE2 or AVX2. SSE2 has no 64 bit compares, so they
+//			are only vectorized with SSE4.2 or AVX2.
+//		- cond_expr, and_then_expr and or_else_expr compute a mask of the
+//			rows that select each operand. An operand no row selects is
+//			skipped, and division only runs on the rows of its mask, so
+//			a division the scalar eval() would not reach never throws.
+//
+// *************************************************************************** //
+
+#if UA_SIMD_WIDTH == 32
+typedef __m256i lanes;
+inline lanes lanes_load(const long long * p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+inline void lanes_store(long long * p, lanes v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+inline lanes lanes_add(lanes a, lanes b) { return _mm256_add_epi64(a, b); }
+inline lanes lanes_sub(lanes a, lanes b) { return _mm256_sub_epi64(a, b); }
+inline lanes lanes_and(lanes a, lanes b) { return _mm256_and_si256(a, b); }
+inline lanes lanes_or(lanes a, lanes b) { return _mm256_or_si256(a, b); }
+inline lanes lanes_xor(lanes a, lanes b) { return _mm256_xor_si256(a, b); }
+inline lanes lanes_one() { return _mm256_set1_epi64x(1); }
+inline lanes lanes_equal(lanes a, lanes b) { return _mm256_and_si256(_mm256_cmpeq_epi64(a, b), lanes_one()); }
+inline lanes lanes_greater(lanes a, lanes b) { return _mm256_and_si256(_mm256_cmpgt_epi64(a, b), lanes_one()); }
+#elif UA_SIMD_WIDTH == 16
+typedef __m128i lanes;
+inline lanes lanes_load(const long long * p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+inline void lanes_store(long long * p, lanes v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+inline lanes lanes_add(lanes a, lanes b) { return _mm_add_epi64(a, b); }
+inline lanes lanes_sub(lanes a, lanes b) { return _mm_sub_epi64(a, b); }
+inline lanes lanes_and(lanes a, lanes b) { return _mm_and_si128(a, b); }
+inline lanes lanes_or(lanes a, lanes b) { return _mm_or_si128(a, b); }
+inline lanes lanes_xor(lanes a, lanes b) { return _mm_xor_si128(a, b); }
+inline lanes lanes_one() { return _mm_set1_epi64x(1); }
+#if UA_SIMD_COMPARE
+inline lanes lanes_equal(lanes a, lanes b) { return _mm_and_si128(_mm_cmpeq_epi64(a, b), lanes_one()); }
+inline lanes lanes_greater(lanes a, lanes b) { return _mm_and_si128(_mm_cmpgt_epi64(a, b), lanes_one()); }
+#endif
+#endif
+
+#if UA_SIMD_WIDTH
+const std::size_t lane_count = UA_SIMD_WIDTH / sizeof(long long);
+#endif
+
+// Applies scalar to every row of a and b, the rows a whole vector covers
+// with vector instead
+template<typename S, typename V>
+void batch_binary(const long long * a, const long long * b, long long * r, std::size_t n, S scalar, V vector)
+{
+	std::size_t i = 0;
+#if UA_SIMD_WIDTH
+	for(; i + lane_count <= n; i += lane_count)
+	{
+		lanes_store(r + i, vector(lanes_load(a + i), lanes_load(b + i)));
+	}
+#endif
+	for(; i < n; ++i)
+	{
+		r[i] = scalar(a[i], b[i]);
+	}
+}
+
+template<typename S>
+void batch_binary(const long long * a, const long long * b, long long * r, std::size_t n, S scalar)
+{
+	for(std::size_t i = 0; i < n; ++i)
+	{
+		r[i] = scalar(a[i], b[i]);
+	}
+}
+
+// Expression visitor that evaluates a chunk of rows
+// Each visit sets result to a column holding the value of every row
+class batch_evaluator : public expr::visitor
+{
+public:
+	static constexpr std::size_t chunk = 1024;
+
+	const long long * const * columns;
+	std::size_t first;			// first row of the chunk
+	std::size_t rows;			// rows in the chunk
+	const long long * mask;		// rows to evaluate, nullptr for all of them
+	long long * result;
+
+	std::vector<long long *> buffers;
+	std::vector<long long *> free_buffers;
+
+	batch_evaluator(const long long * const * columns)
+		: columns(columns), first(0), rows(0), mask(nullptr), result(nullptr) { }
+	~batch_evaluator()
+	{
+		for(long long * b : buffers)
+		{
+			delete[] b;
+		}
+	}
+
+	batch_evaluator(const batch_evaluator &) = delete;
+	batch_evaluator & operator=(const batch_evaluator &) = delete;
+
+	// Returns a free column of chunk rows
+	long long * take()
+	{
+		if(free_buffers.empty())
+		{
+			buffers.push_back(new long long[chunk]);
+			return buffers.back();
+		}
+		long long * b = free_buffers.back();
+		free_buffers.pop_back();
+		return b;
+	}
+
+	void give(long long * b) { free_buffers.push_back(b); }
+
+	// Evaluates e for the rows of m
+	long long * run(expr * e, const long long * m)
+	{
+		const long long * saved = mask;
+		mask = m;
+		e->accept(* this);
+		mask = saved;
+		return result;
+	}
+
+	// Mask of the rows of the current mask where c is (or is not) equal to
+	// val, or nullptr when there are none
+	long long * select(const long long * c, long long val, bool equal)
+	{
+		long long * m = take();
+		long long any = 0;
+		for(std::size_t i = 0; i < rows; ++i)
+		{
+			m[i] = (mask ? mask[i] : 1) & ((c[i] == val) == equal);
+			any |= m[i];
+		}
+		if(any == 0)
+		{
+			give(m);
+			return nullptr;
+		}
+		return m;
+	}
+
+	void fill(long long val)
+	{
+		result = take();
+		std::fill(result, result + rows, val);
+	}
+
+	template<typename S, typename V>
+	void binary(expr * e1, expr * e2, S scalar, V vector)
+	{
+		long long * a = run(e1, mask);
+		long long * b = run(e2, mask);
+		result = take();
+		batch_binary(a, b, result, rows, scalar, vector);
+		give(a);
+		give(b);
+	}
+
+	template<typename S>
+	void binary(expr * e1, expr * e2, S scalar)
+	{
+		long long * a = run(e1, mask);
+		long long * b = run(e2, mask);
+		result = take();
+		batch_binary(a, b, result, rows, scalar);
+		give(a);
+		give(b);
+	}
+
+	// Comparisons are written as a == b or a > b, negated by flipping bit 0
+	// The flags only shape the vector path, the scalar one has them built in
+	template<typename S>
+	void compare(expr * e1, expr * e2, S scalar, [[maybe_unused]] bool greater, [[maybe_unused]] bool swap, [[maybe_unused]] bool negate)
+	{
+#if UA_SIMD_COMPARE
+		if(greater)
+		{
+			if(swap)
+			{
+				binary(e1, e2, scalar, [negate](lanes a, lanes b) { lanes r = lanes_greater(b, a); return negate ? lanes_xor(r, lanes_one()) : r; });
+			}
+			else
+			{
+				binary(e1, e2, scalar, [negate](lanes a, lanes b) { lanes r = lanes_greater(a, b); return negate ? lanes_xor(r, lanes_one()) : r; });
+			}
+		}
+		else
+		{
+			binary(e1, e2, scalar, [negate](lanes a, lanes b) { lanes r = lanes_equal(a, b); return negate ? lanes_xor(r, lanes_one()) : r; });
+		}
+#else
+		binary(e1, e2, scalar);
+#endif
+	}
+
+	// Division only runs on the rows of the mask, like eval() it throws on
+	// those rows where the divisor is zero or the quotient overflows
+	void division(expr * e1, expr * e2, bool remainder)
+	{
+		long long * a = run(e1, mask);
+		long long * b = run(e2, mask);
+		result = take();
+		for(std::size_t i = 0; i < rows; ++i)
+		{
+			if(mask && mask[i] == 0)
+			{
+				result[i] = 0;
+			}
+			else
+			{
+				result[i] = remainder ? int_rem(a[i], b[i]) : int_div(a[i], b[i]);
+			}
+		}
+		give(a);
+		give(b);
+	}
+
+	void visit(bool_expr * e) { fill(convert(e->val)); }
+	void visit(int_expr * e) { fill(e->val); }
+	void visit(ref_expr * e)
+	{
+		result = take();
+		std::memcpy(result, columns[e->slot] + first, rows * sizeof(long long));
+	}
+#if UA_SIMD_WIDTH
+	void visit(and_expr * e) { binary(e->e1, e->e2, [](long long a, long long b) { return a & b; }, lanes_and); }
+	void visit(or_expr * e) { binary(e->e1, e->e2, [](long long a, long long b) { return a | b; }, lanes_or); }
+	void visit(xor_expr * e) { binary(e->e1, e->e2, [](long long a, long long b) { return a ^ b; }, lanes_xor); }
+	void visit(add_expr * e)
+	{
+		binary(e->e1, e->e2, [](long long a, long long b) { return (long long)((unsigned long long)a + b); }, lanes_add);
+	}
+	void visit(sub_expr * e)
+	{
+		binary(e->e1, e->e2, [](long long a, long long b) { return (long long)((unsigned long long)a - b); }, lanes_sub);
+	}
+#else
+	void visit(and_expr * e) { binary(e->e1, e->e2, [](long long a, long long b) { return a & b; }); }
+	void visit(or_expr * e) { binary(e->e1, e->e2, [](long long a, long long b) { return a | b; }); }
+	void visit(xor_expr * e) { binary(e->e1, e->e2, [](long long a, long long b) { return a ^ b; }); }
+	void visit(add_expr * e) { binary(e->e1, e->e2, [](long long a, long long b) { return (long long)((unsigned long long)a + b); }); }
+	void visit(sub_expr * e) { binary(e->e1, e->e2, [](long long a, long long b) { return (long long)((unsigned long long)a - b); }); }
+#endif
+	void visit(not_expr * e)
+	{
+		long long * a = run(e->e, mask);
+		for(std::size_t i = 0; i < rows; ++i)
+		{
+			a[i] = a[i] == 0;
+		}
+		result = a;
+	}
+	void visit(cond_expr * e)
+	{
+		long long * c = run(e->e1, mask);
+		long long * m2 = select(c, 0, false);
+		long long * m3 = select(c, 0, true);
+		long long * a = m2 ? run(e->e2, m2) : nullptr;
+		long long * b = m3 ? run(e->e3, m3) : nullptr;
+		for(std::size_t i = 0; i < rows; ++i)
+		{
+			c[i] = c[i] ? (a ? a[i] : 0) : (b ? b[i] : 0);
+		}
+		for(long long * p : { m2, m3, a, b })
+		{
+			if(p)
+			{
+				give(p);
+			}
+		}
+		result = c;
+	}
+	void visit(equal_expr * e) { compare(e->e1, e->e2, [](long long a, long long b) { return (long long)(a == b); }, false, false, false); }
+	void visit(not_equal_expr * e) { compare(e->e1, e->e2, [](long long a, long long b) { return (long long)(a != b); }, false, false, true); }
+	void visit(less_than_expr * e) { compare(e->e1, e->e2, [](long long a, long long b) { return (long long)(a < b); }, true, true, false); }
+	void visit(greater_than_expr * e) { compare(e->e1, e->e2, [](long long a, long long b) { return (long long)(a > b); }, true, false, false); }
+	void visit(less_than_eq_expr * e) { compare(e->e1, e->e2, [](long long a, long long b) { return (long long)(a <= b); }, true, false, true); }
+	void visit(greater_than_eq_expr * e) { compare(e->e1, e->e2, [](long long a, long long b) { return (long long)(a >= b); }, true, true, true); }
+	void visit(multi_expr * e)
+	{
+		// No 64 bit multiply below AVX-512, left to the compiler
+		binary(e->e1, e->e2, [](long long a, long long b) { return (long long)((unsigned long long)a * b); });
+	}
+	void visit(div_expr * e) { division(e->e1, e->e2, false); }
+	void visit(rem_expr * e) { division(e->e1, e->e2, true); }
+	void visit(neg_expr * e)
+	{
+		long long * a = run(e->e, mask);
+		for(std::size_t i = 0; i < rows; ++i)
+		{
+			a[i] = (long long)(0 - (unsigned long long)a[i]);
+		}
+		result = a;
+	}
+	void visit(and_then_expr * e)
+	{
+		// e1 == 1 ? e2 : false
+		long long * a = run(e->e1, mask);
+		long long * m = select(a, 1, true);
+		long long * b = m ? run(e->e2, m) : nullptr;
+		for(std::size_t i = 0; i < rows; ++i)
+		{
+			a[i] = a[i] == 1 && b ? b[i] : 0;
+		}
+		if(m)
+		{
+			give(m);
+			give(b);
+		}
+		result = a;
+	}
+	void visit(or_else_expr * e)
+	{
+		// e1 when it is non zero, else e2
+		long long * a = run(e->e1, mask);
+		long long * m = select(a, 0, true);
+		if(m)
+		{
+			long long * b = run(e->e2, m);
+			for(std::size_t i = 0; i < rows; ++i)
+			{
+				a[i] = a[i] != 0 ? a[i] : b[i];
+			}
+			give(m);
+			give(b);
+		}
+		result = a;
+	}
+};
+
+// Evaluates e for rows [0, rows) and writes the value of each row to out
+// A ref_expr with slot i reads column i
+void eval_batch(expr * e, const long long * const * columns, std::size_t rows, long long * out)
+{
+	batch_evaluator b(columns);
+	for(b.first = 0; b.first < rows; b.first += batch_evaluator::chunk)
+	{
+		b.rows = std::min(batch_evaluator::chunk, rows - b.first);
+		long long * r = b.run(e, nullptr);
+		std::memcpy(out + b.first, r, b.rows * sizeof(long long));
+		b.give(r);
+	}
+}
+
+#endif
@@ -0,0 +1,1160 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+# include <algorithm>
+# include <chrono>
+# include <cstdio>
+# include <cstring>
+# include <fstream>
+# include <iostream>
+# include <string>
+# include <thread>
+# include <vector>
+
+# include "ast/expression.hpp"
+# include "com/arena.hpp"
+# include "lexer.hpp"
+# include "parser.hpp"
+# include "parallel.hpp"
+# include "pipeline.hpp"
+# include "image.hpp"
+# include "stream.hpp"
+# include "incremental.hpp"
+# include "bytecode.hpp"
+# include "jit.hpp"
+# include "batch.hpp"
+# include "fork.hpp"
+# include "fold.hpp"
+# include "com/charclass.hpp"
+# include "com/source.hpp"
+# include "com/writer.hpp"
+
+// *************************************************************************** //
+// Benchmarks
+// 
+// Summary:
+//		- Each benchmark is selected from the command line with
+//			"-bench <name>" and reports its timings on std::cout.
+//		- Benchmarks build their inputs in memory so the results are not
+//			skewed by reading stdin.
+// 
+// *************************************************************************** //
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Milliseconds elapsed since start
+static double elapsed_ms(bench_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+// Path of the null device that benchmark output is written to
+# ifdef _WIN32
+static const char * null_device = "NUL";
+# else
+static const char * null_device = "/dev/null";
+# endif
+
+// Type check benchmark
+// Builds left-deep add_expr chains (1+2+3+...+n) of doubling length.
+// Construction time per node should stay flat as n grows.
+void bench_check()
+{
+	arena arn;
+
+	for(int n = 1000; n <= 64000; n *= 2)
+	{
+		bench_clock::time_point start = bench_clock::now();
+
+		expr * e = arn.make<int_expr>(0);
+		for(int i = 1; i < n; ++i)
+		{
+			e = arn.make<add_expr>(e, arn.make<int_expr>(i));
+		}
+
+		double ms = elapsed_ms(start);
+		std::cout << "check: " << n << " nodes, " << ms << " ms, "
+			<< (ms * 1000000.0 / n) << " ns/node\n";
+
+		arn.reset();
+	}
+}
+
+// Memory benchmark
+// Parses a million generated lines with one parser and reports the bytes
+// held by its arena as it goes. The arena is reset after every line, so
+// the reserved size should stay constant.
+void bench_memory()
+{
+	const int lines = 1000000;
+
+	// Discard the evaluation output while parsing
+	std::FILE * null_file = std::fopen(null_device, "w");
+	parser prsr(null_file);
+	std::size_t reserved[10];
+	bench_clock::time_point start = bench_clock::now();
+
+	for(int i = 0; i < lines; ++i)
+	{
+		std::string n = std::to_string(i % 1000 + 1);
+		prsr.parse(n + "+2*(" + n + "-3)<7?" + n + ":5%3", output_format::decimal);
+
+		if((i + 1) % (lines / 10) == 0)
+		{
+			reserved[i / (lines / 10)] = prsr.arena_reserved();
+		}
+	}
+
+	prsr.flush();
+	double ms = elapsed_ms(start);
+	std::fclose(null_file);
+
+	for(int i = 0; i < 10; ++i)
+	{
+		std::cout << "memory: " << (i + 1) * (lines / 10) << " lines, arena "
+			<< reserved[i] << " bytes\n";
+	}
+	std::cout << "memory: " << lines << " lines in " << ms << " ms\n";
+}
+
+// Output benchmark
+// Evaluates a statement ten million times and writes each result to the null
+// device, once through std::ostream with std::endl and once through writer.
+void bench_output()
+{
+	const int statements = 10000000;
+
+	arena arn;
+	expr * e = arn.make<add_expr>(arn.make<multi_expr>(arn.make<int_expr>(123), arn.make<int_expr>(456)), arn.make<int_expr>(-7));
+	stmt * s = arn.make<expr_stmt>(e);
+
+	{
+		std::ofstream null_stream(null_device);
+		bench_clock::time_point start = bench_clock::now();
+		for(int i = 0; i < statements; ++i)
+		{
+			null_stream << s->evaluate() << std::endl;
+		}
+		double ms = elapsed_ms(start);
+		std::cout << "output: std::endl, " << statements << " statements in " << ms << " ms ("
+			<< statements / ms / 1000.0 << " M/s)\n";
+	}
+
+	{
+		std::FILE * null_file = std::fopen(null_device, "w");
+		bench_clock::time_point start = bench_clock::now();
+		{
+			writer out(null_file);
+			for(int i = 0; i < statements; ++i)
+			{
+				out.put_int(s->evaluate());
+				out.put('\n');
+			}
+		}
+		double ms = elapsed_ms(start);
+		std::fclose(null_file);
+		std::cout << "output: writer, " << statements << " statements in " << ms << " ms ("
+			<< statements / ms / 1000.0 << " M/s)\n";
+	}
+}
+
+// Builds about size bytes of runs of run_length characters drawn from
+// alphabet, each run ended by a '|'
+static std::string make_runs(std::size_t size, std::size_t run_length, const char * alphabet)
+{
+	std::string text;
+	std::string alpha(alphabet);
+	text.reserve(size + run_length + 1);
+
+	while(text.size() < size)
+	{
+		for(std::size_t i = 0; i < run_length; ++i)
+		{
+			text += alpha[(text.size() * 7 + i) % alpha.size()];
+		}
+		text += '|';
+	}
+
+	return text;
+}
+
+// Times scan over every run in text and reports the throughput
+template<typename Scan>
+static void bench_scan(const char * name, const std::string & text, Scan scan)
+{
+	const char * end = text.data() + text.size();
+	std::size_t runs = 0;
+	bench_clock::time_point start = bench_clock::now();
+
+	for(const char * p = text.data(); p < end; ++runs)
+	{
+		p = scan(p, end) + 1;
+	}
+
+	double ms = elapsed_ms(start);
+	std::cout << "lexer: " << name << ", " << runs << " runs, "
+		<< (text.size() / 1000.0) / ms << " MB/s\n";
+}
+
+// Lexer benchmark
+// Compares the table only scans against the vector fast path (width
+// UA_SIMD_WIDTH, 0 when there is none) on 32 MB of long runs, then reports
+// the throughput of the whole lexer on a generated input.
+void bench_lexer()
+{
+	const std::size_t size = 32 * 1000 * 1000;
+
+	std::cout << "lexer: vector width " << UA_SIMD_WIDTH << " bytes\n";
+
+	std::string spaces = make_runs(size, 64, " \t ");
+	bench_scan("space scalar", spaces, skip_space_scalar);
+	bench_scan("space vector", spaces, skip_space);
+
+	std::string digits = make_runs(size, 48, "0123456789");
+	bench_scan("digits scalar", digits, scan_digits_scalar);
+	bench_scan("digits vector", digits, scan_digits);
+
+	std::string words = make_runs(size, 40, "abcdefghijklmnopqrstuvwxyz_ABCXYZ0123456789");
+	bench_scan("word scalar", words, scan_word_scalar);
+	bench_scan("word vector", words, scan_word);
+
+	std::string text;
+	while(text.size() < size)
+	{
+		text += "123456789 +   total_count * 987654   - 0hFF00 ;      # comment text\n";
+	}
+
+	interner names;
+	lexer lxr(& names);
+	std::vector<token> tokens;
+
+	bench_clock::time_point start = bench_clock::now();
+	lxr.lex(text, tokens);
+	double ms = elapsed_ms(start);
+
+	std::cout << "lexer: lex, " << tokens.size() << " tokens, "
+		<< (text.size() / 1000.0) / ms << " MB/s\n";
+}
+
+// Times evaluating e count times with eval() and with the bytecode vm
+static void bench_vm_expr(const char * name, expr * e, int count)
+{
+	long long sum = 0;
+
+	bench_clock::time_point start = bench_clock::now();
+	for(int i = 0; i < count; ++i)
+	{
+		sum += eval(e);
+	}
+	double tree_ms = elapsed_ms(start);
+
+	program p = compile(e);
+	vm machine;
+
+	start = bench_clock::now();
+	for(int i = 0; i < count; ++i)
+	{
+		sum -= machine.run(p);
+	}
+	double vm_ms = elapsed_ms(start);
+
+	// sum is zero unless the evaluators disagree
+	std::cout << "vm: " << name << ", eval " << (tree_ms * 1000000.0 / count) << " ns, vm "
+		<< (vm_ms * 1000000.0 / count) << " ns";
+
+	jit native;
+	if(native_fn f = native.compile(e))
+	{
+		start = bench_clock::now();
+		for(int i = 0; i < count; ++i)
+		{
+			long long val;
+			f(& val, nullptr);
+			sum += val;
+		}
+		double jit_ms = elapsed_ms(start);
+
+		// Undo the jit's share of the sum against the interpreter
+		sum -= eval(e) * count;
+		std::cout << ", jit " << (jit_ms * 1000000.0 / count) << " ns";
+	}
+
+	std::cout << (sum != 0 ? " MISMATCH" : "") << "\n";
+}
+
+// Bytecode benchmark
+// Evaluates an expression of each of the 21 kinds a million times with the
+// tree walking eval(), with the compiled program on the vm and, where it is
+// supported, with the expression compiled to native code. Operands are
+// small subtrees so every expression has a few levels to walk.
+void bench_vm()
+{
+	const int count = 1000000;
+	arena arn;
+
+	// (n + 3) * 2
+	auto num = [&](long long n) -> expr *
+	{
+		return arn.make<multi_expr>(arn.make<add_expr>(arn.make<int_expr>(n), arn.make<int_expr>(3)), arn.make<int_expr>(2));
+	};
+	// n < 5
+	auto test = [&](long long n) -> expr *
+	{
+		return arn.make<less_than_expr>(arn.make<int_expr>(n), arn.make<int_expr>(5));
+	};
+
+	bench_vm_expr("bool_expr", arn.make<bool_expr>(true), count);
+	bench_vm_expr("int_expr", arn.make<int_expr>(42), count);
+	bench_vm_expr("and_expr", arn.make<and_expr>(test(1), test(7)), count);
+	bench_vm_expr("or_expr", arn.make<or_expr>(test(1), test(7)), count);
+	bench_vm_expr("xor_expr", arn.make<xor_expr>(test(1), test(7)), count);
+	bench_vm_expr("not_expr", arn.make<not_expr>(test(1)), count);
+	bench_vm_expr("cond_expr", arn.make<cond_expr>(test(1), num(2), num(3)), count);
+	bench_vm_expr("equal_expr", arn.make<equal_expr>(num(2), num(3)), count);
+	bench_vm_expr("not_equal_expr", arn.make<not_equal_expr>(num(2), num(3)), count);
+	bench_vm_expr("less_than_expr", arn.make<less_than_expr>(num(2), num(3)), count);
+	bench_vm_expr("greater_than_expr", arn.make<greater_than_expr>(num(2), num(3)), count);
+	bench_vm_expr("less_than_eq_expr", arn.make<less_than_eq_expr>(num(2), num(3)), count);
+	bench_vm_expr("greater_than_eq_expr", arn.make<greater_than_eq_expr>(num(2), num(3)), count);
+	bench_vm_expr("add_expr", arn.make<add_expr>(num(2), num(3)), count);
+	bench_vm_expr("sub_expr", arn.make<sub_expr>(num(2), num(3)), count);
+	bench_vm_expr("multi_expr", arn.make<multi_expr>(num(2), num(3)), count);
+	bench_vm_expr("div_expr", arn.make<div_expr>(num(20), num(3)), count);
+	bench_vm_expr("rem_expr", arn.make<rem_expr>(num(20), num(3)), count);
+	bench_vm_expr("neg_expr", arn.make<neg_expr>(num(2)), count);
+	bench_vm_expr("and_then_expr", arn.make<and_then_expr>(test(1), test(7)), count);
+	bench_vm_expr("or_else_expr", arn.make<or_else_expr>(test(7), test(1)), count);
+}
+
+// Folding benchmark
+// Parses generated lines one at a time, mixing constant subtrees, identities
+// and variables that keep some of each tree from folding. Each expression
+// statement is evaluated repeat times, then folded and evaluated again.
+// Reports the node count and evaluation time before and after folding.
+void bench_fold()
+{
+	const int lines = 20000;
+	const int repeat = 100;
+
+	std::vector<std::string> corpus;
+	for(int i = 0; i < lines; ++i)
+	{
+		std::string n = std::to_string(i);
+		corpus.push_back("var x = " + n + " % 97");
+		corpus.push_back("(x + 0) * 1 + (2 * 3 - 4) * (" + n + " % 7)");
+		corpus.push_back("x > 3 ? x * (1 + 1) : -(-x) + 10 / 2");
+		corpus.push_back("(1 < 2 && " + n + " > 5) || x == 0");
+		corpus.push_back("(" + n + " - 1) * (" + n + " + 1) - x / 1");
+	}
+
+	parser prsr;
+	arena arn;
+	long long nodes = 0, folded_nodes = 0, statements = 0, sum = 0;
+	double tree_ms = 0, folded_ms = 0;
+
+	for(const std::string & line : corpus)
+	{
+		for(stmt * s : prsr.parse_statements(line))
+		{
+			// Declarations are run so the statements after them can read x
+			expr_stmt * es = dynamic_cast<expr_stmt *>(s);
+			if(es == nullptr)
+			{
+				s->evaluate();
+				continue;
+			}
+
+			expr * e = es->e;
+			expr * f = fold(e, arn);
+			nodes += e->size;
+			folded_nodes += f->size;
+			++statements;
+
+			bench_clock::time_point start = bench_clock::now();
+			for(int i = 0; i < repeat; ++i)
+			{
+				sum += eval(e);
+			}
+			tree_ms += elapsed_ms(start);
+
+			start = bench_clock::now();
+			for(int i = 0; i < repeat; ++i)
+			{
+				sum -= eval(f);
+			}
+			folded_ms += elapsed_ms(start);
+
+			arn.reset();
+		}
+	}
+
+	std::cout << "fold: " << statements << " statements, " << nodes << " nodes before, "
+		<< folded_nodes << " after (" << (nodes ? 100.0 * (nodes - folded_nodes) / nodes : 0) << "% fewer)\n";
+	std::cout << "fold: eval " << tree_ms << " ms before, " << folded_ms << " ms after ("
+		<< (folded_ms > 0 ? tree_ms / folded_ms : 0) << "x)" << (sum != 0 ? " MISMATCH" : "") << "\n";
+}
+
+// Sharing benchmark
+// Parses and evaluates highly repetitive inputs with and without sharing
+// identical subtrees, reporting the arena size and the time of each.
+void bench_share_run(const char * name, const std::string & text, bool sharing)
+{
+	const int repeat = 20;
+
+	parser prsr;
+	prsr.set_sharing(sharing);
+
+	bench_clock::time_point start = bench_clock::now();
+	std::vector<stmt *> statements = prsr.parse_statements(text);
+	double parse_ms = elapsed_ms(start);
+
+	long long sum = 0;
+	start = bench_clock::now();
+	for(int i = 0; i < repeat; ++i)
+	{
+		for(stmt * s : statements)
+		{
+			sum += s->evaluate();
+		}
+	}
+	double eval_ms = elapsed_ms(start);
+
+	std::cout << "share: " << name << (sharing ? " shared, " : " tree,   ") << "arena "
+		<< prsr.arena_reserved() << " bytes, parse " << parse_ms << " ms, eval "
+		<< eval_ms << " ms, sum " << sum << "\n";
+}
+
+void bench_share()
+{
+	// One statement whose subtree is repeated 2^14 times
+	std::string nested = "(1+2*3)";
+	for(int i = 0; i < 14; ++i)
+	{
+		nested = "(" + nested + "-" + nested + "+1)";
+	}
+
+	// Many statements drawn from a few templates
+	const char * templates[] = {
+		"(1+2)*(3+4)-(1+2)*(3+4)",
+		"5<3?(2*3+1)%4:(2*3+1)/2",
+		"(7-2)*(7-2)*(7-2)+(7-2)",
+		"(1==1)&&(2<3)||(1==1)",
+	};
+	std::string lines;
+	for(int i = 0; i < 100000; ++i)
+	{
+		lines += templates[i % 4];
+		lines += '\n';
+	}
+
+	bench_share_run("nested", nested, false);
+	bench_share_run("nested", nested, true);
+	bench_share_run("lines ", lines, false);
+	bench_share_run("lines ", lines, true);
+}
+
+// Tiering benchmark
+// Parses a few lines that read a variable, repeated many times, with the
+// line cache on: once running the cached bytecode and once compiling each
+// line to native code after a thousand evaluations.
+std::string bench_jit_run(const std::string & text, std::size_t lines, unsigned threshold)
+{
+	std::string out;
+	parser prsr(& out);
+	prsr.set_cache(1 << 20);
+	prsr.set_jit(threshold);
+
+	bench_clock::time_point start = bench_clock::now();
+	prsr.parse(text, output_format::decimal);
+	prsr.flush();
+	double ms = elapsed_ms(start);
+
+	std::cout << "jit: " << (threshold ? "tiered after " + std::to_string(threshold) : std::string("bytecode"))
+		<< ", " << (ms * 1000000.0 / lines) << " ns per line\n";
+	return out;
+}
+
+void bench_jit()
+{
+	const int repeat = 100000;
+
+	if(!jit::supported)
+	{
+		std::cout << "jit: not supported on this architecture\n";
+	}
+
+	const char * block =
+		"(x+2)*(3+4)-(5+x)*(7-8)\n"
+		"x<3?(2*x+1)%4:(2*x+1)/2\n"
+		"(x-2)*(x-2)*(x-2)+(x-2)\n"
+		"(x==1)&&(2<x)||(4>=x)\n"
+		"-(((x+2)*3+4)*5+x)\n";
+
+	std::string text = "var x = 7\n";
+	for(int i = 0; i < repeat; ++i)
+	{
+		text += block;
+	}
+
+	std::size_t lines = 5 * static_cast<std::size_t>(repeat);
+	std::string interpreted = bench_jit_run(text, lines, 0);
+	std::string tiered = bench_jit_run(text, lines, 1000);
+	if(tiered != interpreted)
+	{
+		std::cout << "jit: MISMATCH\n";
+	}
+}
+
+// Batch benchmark
+// Evaluates expressions over a million rows of two int columns x and y,
+// once calling eval() per row and once with eval_batch().
+void bench_batch()
+{
+	const std::size_t rows = 1000000;
+	const int repeat = 10;
+	arena arn;
+
+	std::vector<long long> xs(rows), ys(rows), out(rows);
+	for(std::size_t i = 0; i < rows; ++i)
+	{
+		xs[i] = static_cast<long long>(i * 7919 % 2001) - 1000;
+		ys[i] = static_cast<long long>(i * 104729 % 201) - 100;
+	}
+	const long long * columns[] = { xs.data(), ys.data() };
+
+	// Scalar eval() reads the slots of the current row from env
+	std::vector<long long> env(2);
+	expr * x = arn.make<ref_expr>(& types().int_type, 0, & env);
+	expr * y = arn.make<ref_expr>(& types().int_type, 1, & env);
+	expr * three = arn.make<int_expr>(3);
+
+	struct named { const char * name; expr * e; };
+	named exprs[] = {
+		// x + y * 3 - y
+		{ "arithmetic", arn.make<sub_expr>(arn.make<add_expr>(x, arn.make<multi_expr>(y, three)), y) },
+		// x < y ^ x + y >= 3
+		{ "compare", arn.make<xor_expr>(arn.make<less_than_expr>(x, y), arn.make<greater_than_eq_expr>(arn.make<add_expr>(x, y), three)) },
+		// y != 0 ? x / y : x - 3
+		{ "guarded division", arn.make<cond_expr>(arn.make<not_equal_expr>(y, arn.make<int_expr>(0)),
+			arn.make<div_expr>(x, y), arn.make<sub_expr>(x, three)) },
+		// x > 0 && y > 0 || x == y
+		{ "short circuit", arn.make<or_else_expr>(arn.make<and_then_expr>(arn.make<greater_than_expr>(x, arn.make<int_expr>(0)),
+			arn.make<greater_than_expr>(y, arn.make<int_expr>(0))), arn.make<equal_expr>(x, y)) },
+	};
+
+	for(named & n : exprs)
+	{
+		long long sum = 0;
+		bench_clock::time_point start = bench_clock::now();
+		for(int r = 0; r < repeat; ++r)
+		{
+			for(std::size_t i = 0; i < rows; ++i)
+			{
+				env[0] = xs[i];
+				env[1] = ys[i];
+				sum += eval(n.e);
+			}
+		}
+		double row_ms = elapsed_ms(start);
+
+		start = bench_clock::now();
+		for(int r = 0; r < repeat; ++r)
+		{
+			eval_batch(n.e, columns, rows, out.data());
+			for(std::size_t i = 0; i < rows; ++i)
+			{
+				sum -= out[i];
+			}
+		}
+		double batch_ms = elapsed_ms(start);
+
+		// sum is zero unless the two evaluators disagree
+		std::cout << "batch: " << n.name << ", eval " << (row_ms * 1000000.0 / (rows * repeat)) << " ns per row, batch "
+			<< (batch_ms * 1000000.0 / (rows * repeat)) << " ns per row (" << (batch_ms > 0 ? row_ms / batch_ms : 0) << "x)"
+			<< (sum != 0 ? " MISMATCH" : "") << "\n";
+	}
+}
+
+// Parallel parsing benchmark
+// Parses the same independent lines with 1, 2, 4, ... threads up to the
+// number of hardware threads and reports the speedup over one thread.
+void bench_parallel()
+{
+	const int lines = 400000;
+	std::string text;
+	for(int i = 0; i < lines; ++i)
+	{
+		std::string n = std::to_string(i);
+		text += "(" + n + " * 7 + 3) % 11 == 2 && " + n + " - 5 < 100000 || " + n + " / 3 > 7\n";
+	}
+
+	std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	std::FILE * null = std::fopen(null_device, "w");
+	double single = 0;
+
+	for(std::size_t threads = 1; ; threads *= 2)
+	{
+		threads = std::min(threads, cores);
+		parallel_parser prsr(threads, 64 * 1024, null);
+
+		bench_clock::time_point start = bench_clock::now();
+		prsr.parse(text, output_format::decimal);
+		prsr.flush();
+		double ms = elapsed_ms(start);
+
+		if(threads == 1)
+		{
+			single = ms;
+		}
+		std::cout << "parallel: " << threads << " threads, " << ms << " ms, "
+			<< (text.size() / 1000.0) / ms << " MB/s (" << (ms > 0 ? single / ms : 0) << "x)\n";
+
+		if(threads == cores)
+		{
+			break;
+		}
+	}
+
+	std::fclose(null);
+}
+
+// Pipeline benchmark
+// Reads the same lines from a temporary file with one parser and with the
+// pipelined stages; the pipeline approaches the time of its slowest stage
+// when there are cores for every stage.
+void bench_pipeline()
+{
+	const int lines = 300000;
+	std::FILE * in = std::tmpfile();
+	std::FILE * null = std::fopen(null_device, "w");
+	if(in == nullptr || null == nullptr)
+	{
+		std::cerr << "pipeline: cannot open temporary files\n";
+		return;
+	}
+
+	std::size_t bytes = 0;
+	for(int i = 0; i < lines; ++i)
+	{
+		std::string n = std::to_string(i);
+		std::string line = "var x = " + n + " * 3 ; (x + 7) % 11 == 2 && x - 5 < 100000 || x / 3 > 7\n";
+		std::fwrite(line.data(), 1, line.size(), in);
+		bytes += line.size();
+	}
+
+	// Each run reads the file from the start
+	std::vector<char> block(64 * 1024);
+	std::rewind(in);
+	bench_clock::time_point start = bench_clock::now();
+	{
+		parser prsr(null);
+		std::string text;
+		std::size_t n;
+		while((n = std::fread(block.data(), 1, block.size(), in)) > 0)
+		{
+			text.append(block.data(), n);
+			std::size_t nl = text.rfind('\n');
+			if(nl != std::string::npos)
+			{
+				prsr.parse(std::string_view(text).substr(0, nl + 1), output_format::decimal);
+				text.erase(0, nl + 1);
+			}
+		}
+		prsr.parse(text, output_format::decimal);
+	}
+	double serial = elapsed_ms(start);
+
+	std::rewind(in);
+	start = bench_clock::now();
+	{
+		pipeline stages(null);
+		stages.run(in);
+	}
+	double piped = elapsed_ms(start);
+
+	std::cout << "pipeline: " << lines * 2 << " statements, serial " << serial << " ms, "
+		<< (bytes / 1000.0) / serial << " MB/s, pipelined " << piped << " ms, "
+		<< (bytes / 1000.0) / piped << " MB/s (" << (piped > 0 ? serial / piped : 0) << "x)\n";
+
+	std::fclose(null);
+	std::fclose(in);
+}
+
+// Line cache benchmark
+// Parses a million lines drawn from a thousand distinct ones, half of them
+// reading a variable, with and without the line cache.
+void bench_cache()
+{
+	const int lines = 1000000;
+	const int distinct = 1000;
+	std::string text = "var x = 12345\n";
+	for(int i = 0; i < lines; ++i)
+	{
+		std::string n = std::to_string(i * 7919LL % distinct);
+		if(i % 2)
+		{
+			text += "(" + n + " * 7 + 3) % 11 == 2 && " + n + " - 5 < 100000 || " + n + " / 3 > 7\n";
+		}
+		else
+		{
+			text += "x * " + n + " + (x % 13 == 4 ? " + n + " : x - " + n + ")\n";
+		}
+	}
+
+	std::FILE * null = std::fopen(null_device, "w");
+	for(std::size_t cap : { std::size_t(0), std::size_t(64 * 1024), std::size_t(1024 * 1024) })
+	{
+		parser prsr(null);
+		prsr.set_cache(cap);
+
+		// Parsed in blocks of whole lines, as a file would be
+		bench_clock::time_point start = bench_clock::now();
+		std::string_view rest = text;
+		while(!rest.empty())
+		{
+			std::size_t n = rest.find('\n', std::min(rest.size(), std::size_t(1 << 20)) - 1);
+			n = n == std::string_view::npos ? rest.size() : n + 1;
+			prsr.parse(rest.substr(0, n), output_format::decimal);
+			rest.remove_prefix(n);
+		}
+		prsr.flush();
+		double ms = elapsed_ms(start);
+
+		std::cout << "cache: " << cap / 1024 << " KiB, " << ms << " ms, " << (text.size() / 1000.0) / ms << " MB/s";
+		if(const line_cache * c = prsr.cache())
+		{
+			std::cout << ", " << c->hits() << " hits, " << c->misses() << " misses, " << c->evictions() << " evictions";
+		}
+		std::cout << "\n";
+	}
+	std::fclose(null);
+}
+
+// Image benchmark
+// Starts from 100k statements of source text or from their image: parsing
+// the text, mapping and checking the image, then evaluating it in place or
+// loading it back into nodes.
+void bench_image()
+{
+	const int count = 100000;
+	const char * path = "image_bench.tmp";
+	std::string text = "var x = 7\n";
+	for(int i = 1; i < count; ++i)
+	{
+		std::string n = std::to_string(i);
+		if(i % 4 == 0)
+		{
+			text += "var x = x % 1000 + " + n + "\n";
+		}
+		else
+		{
+			text += "(x * " + n + " + 3) % 11 == 2 && x - " + n + " < 100000 || x / 3 > " + n + "\n";
+		}
+	}
+
+	// Cold start: a new parser lexes and parses everything
+	bench_clock::time_point start = bench_clock::now();
+	long long parsed = 0;
+	{
+		parser prsr;
+		for(stmt * s : prsr.parse_statements(text))
+		{
+			parsed += s->evaluate();
+		}
+	}
+	double parse_ms = elapsed_ms(start);
+
+	{
+		parser prsr;
+		std::FILE * file = std::fopen(path, "wb");
+		if(file == nullptr)
+		{
+			std::cerr << "image: cannot write " << path << "\n";
+			return;
+		}
+		writer out(file);
+		write_image(prsr.parse_statements(text), out);
+		out.flush();
+		std::fclose(file);
+	}
+
+	{
+		start = bench_clock::now();
+		mapped_file file(path);
+		image img(file.view());
+		double map_ms = elapsed_ms(start);
+
+		start = bench_clock::now();
+		std::vector<long long> values;
+		long long run = 0;
+		for(std::size_t i = 0; i < img.statements(); ++i)
+		{
+			run += img.evaluate(i, values);
+		}
+		double run_ms = elapsed_ms(start);
+
+		start = bench_clock::now();
+		arena arn;
+		std::vector<long long> loaded_values;
+		long long loaded = 0;
+		for(stmt * s : img.load(arn, & loaded_values))
+		{
+			loaded += s->evaluate();
+		}
+		double load_ms = elapsed_ms(start);
+
+		std::cout << "image: " << count << " statements, " << text.size() << " bytes of text, "
+			<< file.view().size() << " bytes of image\n"
+			<< "image: parse and evaluate " << parse_ms << " ms\n"
+			<< "image: map and check " << map_ms << " ms, evaluate in place " << run_ms << " ms ("
+			<< (map_ms + run_ms > 0 ? parse_ms / (map_ms + run_ms) : 0) << "x)\n"
+			<< "image: load and evaluate " << load_ms << " ms"
+			<< (run != parsed || loaded != parsed ? " MISMATCH" : "") << "\n";
+	}
+	std::remove(path);
+}
+
+// Compares lexing and parsing text against replaying its token stream
+void bench_tokens()
+{
+	const int count = 200000;
+	std::string text = "var total = 0\n";
+	for(int i = 1; i < count; ++i)
+	{
+		std::string n = std::to_string(i);
+		if(i % 8 == 0)
+		{
+			text += "var total = total % 1000 + 0h" + std::to_string(i % 10) + "\n";
+		}
+		else
+		{
+			text += "(total * " + n + " + 3) % 11 == 2 && total - " + n + " < 100000 || total / 3 > " + n + " # " + n + "\n";
+		}
+	}
+
+	std::string stream;
+	{
+		writer out(& stream);
+		write_tokens(text, out);
+	}
+
+	// The stream must stay 8 byte aligned
+	std::vector<long long> aligned((stream.size() + 7) / 8);
+	std::memcpy(aligned.data(), stream.data(), stream.size());
+	std::string_view bytes(reinterpret_cast<const char *>(aligned.data()), stream.size());
+
+	std::string lexed_out;
+	bench_clock::time_point start = bench_clock::now();
+	{
+		parser prsr(& lexed_out);
+		prsr.parse(text, output_format::decimal);
+		prsr.flush();
+	}
+	double lex_ms = elapsed_ms(start);
+
+	std::string replayed_out;
+	start = bench_clock::now();
+	{
+		token_stream ts(bytes);
+		parser prsr(& replayed_out);
+		prsr.replay(ts);
+		prsr.flush();
+	}
+	double replay_ms = elapsed_ms(start);
+
+	std::cout << "tokens: " << count << " lines, " << text.size() << " bytes of text, "
+		<< stream.size() << " bytes of tokens\n"
+		<< "tokens: lex, parse and evaluate " << lex_ms << " ms\n"
+		<< "tokens: replay, parse and evaluate " << replay_ms << " ms ("
+		<< (replay_ms > 0 ? lex_ms / replay_ms : 0) << "x)"
+		<< (lexed_out != replayed_out ? " MISMATCH" : "") << "\n";
+}
+
+// Latency of single character edits to a large program, typed and then
+// deleted at random places, against parsing the whole text again
+void bench_edit()
+{
+	const int count = 50000;
+	const int edits = 2000;
+	std::string text = "var total = 0\n";
+	for(int i = 1; i < count; ++i)
+	{
+		std::string n = std::to_string(i);
+		if(i % 8 == 0)
+		{
+			text += "var total = total % 1000 + " + n + "\n";
+		}
+		else
+		{
+			text += "(total * " + n + " + 3) % 11 == 2 && total - " + n + " < 100000 || total / 3 > " + n + "\n";
+		}
+	}
+
+	bench_clock::time_point start = bench_clock::now();
+	{
+		parser prsr;
+		prsr.parse_statements(text);
+	}
+	double full_ms = elapsed_ms(start);
+
+	incremental_parser doc;
+	start = bench_clock::now();
+	doc.load(text);
+	double load_ms = elapsed_ms(start);
+
+	// Typing a digit and deleting it again, so the program stays the same
+	std::vector<double> latency;
+	std::uint64_t seed = 1;
+	for(int i = 0; i < edits; ++i)
+	{
+		seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+		std::size_t row = static_cast<std::size_t>(seed >> 33) % count;
+		std::size_t column = static_cast<std::size_t>(seed >> 17) % (row % 8 == 0 ? 14 : 60);
+		std::string digit(1, static_cast<char>('0' + i % 10));
+
+		start = bench_clock::now();
+		doc.edit(row, column, 0, digit);
+		latency.push_back(elapsed_ms(start));
+
+		start = bench_clock::now();
+		doc.edit(row, column, 1, "");
+		latency.push_back(elapsed_ms(start));
+	}
+
+	std::sort(latency.begin(), latency.end());
+	double sum = 0;
+	for(double ms : latency)
+	{
+		sum += ms;
+	}
+
+	std::string out;
+	{
+		writer w(& out);
+		doc.evaluate(w);
+	}
+	std::string expected;
+	{
+		parser prsr(& expected);
+		prsr.parse(text, output_format::decimal);
+		prsr.flush();
+	}
+
+	std::cout << "edit: " << count << " lines, " << text.size() << " bytes\n"
+		<< "edit: lex and parse everything " << full_ms << " ms, load " << load_ms << " ms\n"
+		<< "edit: " << latency.size() << " keystrokes, mean " << sum / latency.size() * 1000
+		<< " us, median " << latency[latency.size() / 2] * 1000 << " us, 99th " << latency[latency.size() * 99 / 100] * 1000
+		<< " us, max " << latency.back() * 1000 << " us\n"
+		<< "edit: " << doc.relexed() << " lines lexed, " << doc.reparsed() << " lines parsed"
+		<< (doc.text() != text || out != expected ? " MISMATCH" : "") << "\n";
+}
+
+// Times eager and lazy evaluation of a program whose declarations are
+// mostly never read, and of one whose declarations all are
+void bench_lazy()
+{
+	const int count = 200000;
+	std::string sparse;
+	std::string dense = "var x = 0\n";
+	for(int i = 0; i < count; ++i)
+	{
+		std::string n = std::to_string(i);
+		std::string v = "v" + std::to_string(i % 1000);
+		sparse += "var " + v + " = (" + n + " * 7 + 3) % 11 * (" + n + " - 5) / 3 + " + n + " % 13\n";
+		if(i % 100 == 99)
+		{
+			sparse += v + " + 1\n";
+		}
+		dense += "var x = x % 1000 + " + n + "\nx * 2 == " + n + " || x > 5\n";
+	}
+
+	const char * names[] = { "sparse", "dense" };
+	const std::string * texts[] = { & sparse, & dense };
+	for(int k = 0; k < 2; ++k)
+	{
+		std::string eager_out;
+		bench_clock::time_point start = bench_clock::now();
+		{
+			parser prsr(& eager_out);
+			prsr.parse(* texts[k], output_format::decimal);
+			prsr.flush();
+		}
+		double eager_ms = elapsed_ms(start);
+
+		std::string lazy_out;
+		std::size_t forced;
+		std::size_t thunks;
+		start = bench_clock::now();
+		{
+			parser prsr(& lazy_out);
+			prsr.set_lazy(true);
+			prsr.parse(* texts[k], output_format::decimal);
+			prsr.flush();
+			forced = prsr.thunks()->forced();
+			thunks = prsr.thunks()->size();
+		}
+		double lazy_ms = elapsed_ms(start);
+
+		std::cout << "lazy: " << names[k] << ", eager " << eager_ms << " ms, lazy " << lazy_ms << " ms ("
+			<< (lazy_ms > 0 ? eager_ms / lazy_ms : 0) << "x), " << forced << " of " << thunks << " thunks evaluated\n";
+	}
+}
+
+// Balanced tree of 2^depth leaves, alternating + and - between levels
+static expr * balanced(arena & arn, int depth, long long & leaf)
+{
+	if(depth == 0)
+	{
+		return arn.make<int_expr>(leaf++ % 7 + 1);
+	}
+
+	expr * e1 = balanced(arn, depth - 1, leaf);
+	expr * e2 = balanced(arn, depth - 1, leaf);
+	if(depth % 2)
+	{
+		return arn.make<add_expr>(e1, e2);
+	}
+	return arn.make<sub_expr>(e1, e2);
+}
+
+// Fork evaluation benchmark
+// Evaluates a cond_expr over two balanced trees of a million leaves each
+// with eval() and with fork_evaluator on 1, 2, 4, ... threads.
+void bench_fork()
+{
+	const int repeat = 5;
+	arena arn;
+	long long leaf = 0;
+
+	// a < b ? b - a : a - b
+	expr * a = balanced(arn, 20, leaf);
+	expr * b = balanced(arn, 20, leaf);
+	expr * e = arn.make<cond_expr>(arn.make<less_than_expr>(a, b), arn.make<sub_expr>(b, a), arn.make<sub_expr>(a, b));
+
+	long long expected = 0;
+	bench_clock::time_point start = bench_clock::now();
+	for(int r = 0; r < repeat; ++r)
+	{
+		expected += eval(e);
+	}
+	double single = elapsed_ms(start) / repeat;
+	std::cout << "fork: " << e->size << " nodes, eval " << single << " ms\n";
+
+	std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	for(std::size_t threads = 1; ; threads *= 2)
+	{
+		threads = std::min(threads, cores);
+		fork_evaluator f(threads);
+
+		long long sum = 0;
+		start = bench_clock::now();
+		for(int r = 0; r < repeat; ++r)
+		{
+			sum += f.eval(e);
+		}
+		double ms = elapsed_ms(start) / repeat;
+
+		std::cout << "fork: " << threads << " threads, " << ms << " ms (" << (ms > 0 ? single / ms : 0) << "x)"
+			<< (sum != expected ? " MISMATCH" : "") << "\n";
+
+		if(threads == cores)
+		{
+			break;
+		}
+	}
+}
+
+// Runs the benchmark with the given name
+int run_bench(std::string name)
+{
+	if(name == "check")
+	{
+		bench_check();
+		return 0;
+	}
+	else if(name == "memory")
+	{
+		bench_memory();
+		return 0;
+	}
+	else if(name == "output")
+	{
+		bench_output();
+		return 0;
+	}
+	else if(name == "lexer")
+	{
+		bench_lexer();
+		return 0;
+	}
+	else if(name == "vm")
+	{
+		bench_vm();
+		return 0;
+	}
+	else if(name == "fold")
+	{
+		bench_fold();
+		return 0;
+	}
+	else if(name == "share")
+	{
+		bench_share();
+		return 0;
+	}
+	else if(name == "jit")
+	{
+		bench_jit();
+		return 0;
+	}
+	else if(name == "batch")
+	{
+		bench_batch();
+		return 0;
+	}
+	else if(name == "parallel")
+	{
+		bench_parallel();
+		return 0;
+	}
+	else if(name == "pipeline")
+	{
+		bench_pipeline();
+		return 0;
+	}
+	else if(name == "cache")
+	{
+		bench_cache();
+		return 0;
+	}
+	else if(name == "image")
+	{
+		bench_image();
+		return 0;
+	}
+	else if(name == "tokens")
+	{
+		bench_tokens();
+		return 0;
+	}
+	else if(name == "edit")
+	{
+		bench_edit();
+		return 0;
+	}
+	else if(name == "lazy")
+	{
+		bench_lazy();
+		return 0;
+	}
+	else if(name == "fork")
+	{
+		bench_fork();
+		return 0;
+	}
+
+	std::cerr << "unknown benchmark: " << name << std::endl;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+# include <vector>
+
+# include "ast/expression.hpp"
+
+// *************************************************************************** //
+// Bytecode
+// 
+// Summary:
+//		- compile() flattens an expression tree into a linear program for
+//			a stack machine, so repeated evaluation walks an array of
+//			instructions instead of recursing through accept() with a new
+//			visitor per node.
+//		- Every instruction pops its operands and pushes its result.
+//			Literals are pushed from the program's constant pool, slots
+//			of ref_expr are read from its value array when it runs.
+//		- cond_expr, and_then_expr and or_else_expr compile to jumps so
+//			only the selected sub expression is run, as in eval().
+//		- vm::run() executes a program in a tight loop and returns the value
+//			left on the stack. It dispatches with computed gotos where the
+//			compiler supports them (GCC, Clang) and with a switch otherwise.
+// 
+// *************************************************************************** //
+enum opcode : unsigned char
+{
+	op_push,			// push constants[arg]
+	op_load,			// push (* values)[arg]
+	op_and,
+	op_or,
+	op_xor,
+	op_not,
+	op_equal,
+	op_not_equal,
+	op_less_than,
+	op_greater_than,
+	op_less_than_eq,
+	op_greater_than_eq,
+	op_add,
+	op_sub,
+	op_multi,
+	op_div,
+	op_rem,
+	op_neg,
+	op_jump,			// continue at arg
+	op_jump_if_false,	// pop, continue at arg if zero
+	op_jump_if_true_keep,	// continue at arg if the top is non zero, else pop
+	op_halt
+};
+
+struct instruction
+{
+	opcode op;
+	int arg;
+};
+
+class program
+{
+public:
+	std::vector<instruction> code;
+	std::vector<long long> constants;
+	const std::vector<long long> * values;	// array read by op_load
+	int max_depth;
+
+	program() : values(nullptr), max_depth(0) { }
+};
+
+// Compiles the expression argument into a program
+program compile(expr * e)
+{
+	// Derived expression visitor class
+	// Emits the code of each expression after the code of its sub expressions
+	class compiler : public expr::visitor
+	{
+	public:
+		program p;
+		int depth;
+
+		compiler() : depth(0) { }
+
+		int emit(opcode op, int arg = 0)
+		{
+			p.code.push_back({ op, arg });
+			return static_cast<int>(p.code.size()) - 1;
+		}
+
+		void push(long long val)
+		{
+			p.constants.push_back(val);
+			emit(op_push, static_cast<int>(p.constants.size()) - 1);
+			if(++depth > p.max_depth)
+			{
+				p.max_depth = depth;
+			}
+		}
+
+		// Pops two operands and pushes one result
+		void binary(expr * e1, expr * e2, opcode op)
+		{
+			e1->accept(* this);
+			e2->accept(* this);
+			emit(op);
+			--depth;
+		}
+
+		// Points the jump at index to the next instruction
+		void patch(int index) { p.code[index].arg = static_cast<int>(p.code.size()); }
+
+		void visit(bool_expr * e) { push(convert(e->val)); }
+		void visit(int_expr * e) { push(e->val); }
+		void visit(ref_expr * e)
+		{
+			p.values = e->values;
+			emit(op_load, e->slot);
+			if(++depth > p.max_depth)
+			{
+				p.max_depth = depth;
+			}
+		}
+		void visit(and_expr * e) { binary(e->e1, e->e2, op_and); }
+		void visit(or_expr * e) { binary(e->e1, e->e2, op_or); }
+		void visit(xor_expr * e) { binary(e->e1, e->e2, op_xor); }
+		void visit(not_expr * e) { e->e->accept(* this); emit(op_not); }
+		void visit(cond_expr * e)
+		{
+			e->e1->accept(* this);
+			int to_else = emit(op_jump_if_false);
+			--depth;
+			e->e2->accept(* this);
+			int to_end = emit(op_jump);
+			--depth;
+			patch(to_else);
+			e->e3->accept(* this);
+			patch(to_end);
+		}
+		void visit(equal_expr * e) { binary(e->e1, e->e2, op_equal); }
+		void visit(not_equal_expr * e) { binary(e->e1, e->e2, op_not_equal); }
+		void visit(less_than_expr * e) { binary(e->e1, e->e2, op_less_than); }
+		void visit(greater_than_expr * e) { binary(e->e1, e->e2, op_greater_than); }
+		void visit(less_than_eq_expr * e) { binary(e->e1, e->e2, op_less_than_eq); }
+		void visit(greater_than_eq_expr * e) { binary(e->e1, e->e2, op_greater_than_eq); }
+		void visit(add_expr * e) { binary(e->e1, e->e2, op_add); }
+		void visit(sub_expr * e) { binary(e->e1, e->e2, op_sub); }
+		void visit(multi_expr * e) { binary(e->e1, e->e2, op_multi); }
+		void visit(div_expr * e) { binary(e->e1, e->e2, op_div); }
+		void visit(rem_expr * e) { binary(e->e1, e->e2, op_rem); }
+		void visit(neg_expr * e) { e->e->accept(* this); emit(op_neg); }
+		void visit(and_then_expr * e)
+		{
+			// e1 ? e2 : false
+			e->e1->accept(* this);
+			int to_false = emit(op_jump_if_false);
+			--depth;
+			e->e2->accept(* this);
+			int to_end = emit(op_jump);
+			--depth;
+			patch(to_false);
+			push(0);
+			patch(to_end);
+		}
+		void visit(or_else_expr * e)
+		{
+			// e1 if it is non zero, else e2
+			e->e1->accept(* this);
+			int to_end = emit(op_jump_if_true_keep);
+			--depth;
+			e->e2->accept(* this);
+			patch(to_end);
+		}
+	};
+
+	compiler c;
+	e->accept(c);
+	c.emit(op_halt);
+	return c.p;
+}
+
+// *************************************************************************** //
+// Virtual machine class
+// 
+// Summary:
+//		- Runs compiled programs. The operand stack is kept between runs
+//			so evaluating the same program repeatedly does not allocate.
+// 
+// *************************************************************************** //
+class vm
+{
+private:
+	std::vector<long long> stack;
+
+public:
+	vm() { }
+	~vm() { }
+
+	long long run(const program &);
+};
+
+long long vm::run(const program & p)
+{
+	if(stack.size() < static_cast<std::size_t>(p.max_depth) + 1)
+	{
+		stack.resize(p.max_depth + 1);
+	}
+
+	const instruction * code = p.code.data();
+	const long long * constants = p.constants.data();
+	const long long * values = p.values ? p.values->data() : nullptr;
+	const instruction * ip = code;
+
+	// sp points at the top of the stack
+	long long * sp = stack.data() - 1;
+
+#if defined(__GNUC__)
+	// Computed goto dispatch, each handler jumps straight to the next one
+	static void * const labels[] =
+	{
+		&& l_push, && l_load, && l_and, && l_or, && l_xor, && l_not, && l_equal, && l_not_equal,
+		&& l_less_than, && l_greater_than, && l_less_than_eq, && l_greater_than_eq,
+		&& l_add, && l_sub, && l_multi, && l_div, && l_rem, && l_neg,
+		&& l_jump, && l_jump_if_false, && l_jump_if_true_keep, && l_halt
+	};
+	#define DISPATCH() goto * labels[ip->op]
+	#define NEXT(body) { body; ++ip; DISPATCH(); }
+
+	DISPATCH();
+	l_push: NEXT(* ++sp = constants[ip->arg])
+	l_load: NEXT(* ++sp = values[ip->arg])
+	l_and: NEXT(sp[-1] = (sp[-1] & sp[0]) != 0; --sp)
+	l_or: NEXT(sp[-1] = (sp[-1] | sp[0]) != 0; --sp)
+	l_xor: NEXT(sp[-1] = (sp[-1] ^ sp[0]) != 0; --sp)
+	l_not: NEXT(sp[0] = !sp[0])
+	l_equal: NEXT(sp[-1] = sp[-1] == sp[0]; --sp)
+	l_not_equal: NEXT(sp[-1] = sp[-1] != sp[0]; --sp)
+	l_less_than: NEXT(sp[-1] = sp[-1] < sp[0]; --sp)
+	l_greater_than: NEXT(sp[-1] = sp[-1] > sp[0]; --sp)
+	l_less_than_eq: NEXT(sp[-1] = sp[-1] <= sp[0]; --sp)
+	l_greater_than_eq: NEXT(sp[-1] = sp[-1] >= sp[0]; --sp)
+	l_add: NEXT(sp[-1] = sp[-1] + sp[0]; --sp)
+	l_sub: NEXT(sp[-1] = sp[-1] - sp[0]; --sp)
+	l_multi: NEXT(sp[-1] = sp[-1] * sp[0]; --sp)
+	l_div: NEXT(sp[-1] = int_div(sp[-1], sp[0]); --sp)
+	l_rem: NEXT(sp[-1] = int_rem(sp[-1], sp[0]); --sp)
+	l_neg: NEXT(sp[0] = -sp[0])
+	l_jump: ip = code + ip->arg; DISPATCH();
+	l_jump_if_false: if(* sp-- == 0) { ip = code + ip->arg; } else { ++ip; } DISPATCH();
+	l_jump_if_true_keep: if(* sp != 0) { ip = code + ip->arg; } else { --sp; ++ip; } DISPATCH();
+	l_halt: return * sp;
+
+	#undef NEXT
+	#undef DISPATCH
+#else
+	while(true)
+	{
+		const instruction & i = * ip++;
+		switch(i.op)
+		{
+			case op_push: * ++sp = constants[i.arg]; break;
+			case op_load: * ++sp = values[i.arg]; break;
+			case op_and: sp[-1] = (sp[-1] & sp[0]) != 0; --sp; break;
+			case op_or: sp[-1] = (sp[-1] | sp[0]) != 0; --sp; break;
+			case op_xor: sp[-1] = (sp[-1] ^ sp[0]) != 0; --sp; break;
+			case op_not: sp[0] = !sp[0]; break;
+			case op_equal: sp[-1] = sp[-1] == sp[0]; --sp; break;
+			case op_not_equal: sp[-1] = sp[-1] != sp[0]; --sp; break;
+			case op_less_than: sp[-1] = sp[-1] < sp[0]; --sp; break;
+			case op_greater_than: sp[-1] = sp[-1] > sp[0]; --sp; break;
+			case op_less_than_eq: sp[-1] = sp[-1] <= sp[0]; --sp; break;
+			case op_greater_than_eq: sp[-1] = sp[-1] >= sp[0]; --sp; break;
+			case op_add: sp[-1] = sp[-1] + sp[0]; --sp; break;
+			case op_sub: sp[-1] = sp[-1] - sp[0]; --sp; break;
+			case op_multi: sp[-1] = sp[-1] * sp[0]; --sp; break;
+			case op_div: sp[-1] = int_div(sp[-1], sp[0]); --sp; break;
+			case op_rem: sp[-1] = int_rem(sp[-1], sp[0]); --sp; break;
+			case op_neg: sp[0] = -sp[0]; break;
+			case op_jump: ip = code + i.arg; break;
+			case op_jump_if_false: if(* sp-- == 0) { ip = code + i.arg; } break;
+			case op_jump_if_true_keep: if(* sp != 0) { ip = code + i.arg; } else { --sp; } break;
+			case op_halt: return * sp;
+		}
+	}
+#endif
+}
+
+#endif
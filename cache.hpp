@@ -0,0 +1,226 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+# include <cstddef>
+# include <cstdint>
+# include <cstring>
+# include <string>
+# include <string_view>
+# include <unordered_map>
+# include <vector>
+
+# include "bytecode.hpp"
+# include "jit.hpp"
+
+// *************************************************************************** //
+// Line cache class
+//
+// Summary:
+//		- Remembers what each line of input parsed to, keyed by a hash of
+//			its text, so a repeated line is neither lexed nor parsed again.
+//		- A line whose statements are all constant keeps its results and
+//			is answered without evaluating anything.
+//		- A line that reads variables keeps its statements compiled to
+//			bytecode. It is valid only while the parser's bindings are the
+//			same as when it was parsed, which the parser tracks with an
+//			epoch that moves whenever a name is bound to a new slot.
+//		- Lines that declare variables are not cached, since parsing them
+//			changes the bindings.
+//		- runs counts the evaluations of a line that reads variables. Once
+//			it reaches the jit's threshold the parser compiles the line's
+//			statements to native code, kept in natives until the entry is
+//			evicted. The cap counts the bytecode, not the native code.
+//		- Entries are evicted with the CLOCK algorithm once their total
+//			size would pass the memory cap: the hand sweeps the entries,
+//			sparing and unmarking each one used since it last passed.
+//		- The full text is kept to tell lines with the same hash apart.
+//
+// *************************************************************************** //
+class line_cache
+{
+public:
+	struct entry
+	{
+		std::string line;
+		std::vector<program> programs;
+		std::vector<native_fn> natives;
+		std::vector<long long> results;
+		unsigned epoch;
+		unsigned runs;
+		bool constant;
+		bool used;
+		std::size_t bytes;
+		std::uint64_t hash;
+	};
+
+private:
+	std::vector<entry> entries;
+	std::vector<std::size_t> unused;
+	std::unordered_map<std::uint64_t, std::size_t> index;
+	jit * code;
+	std::size_t hand;
+	std::size_t total;
+	std::size_t cap;
+	std::size_t hit_count;
+	std::size_t miss_count;
+	std::size_t eviction_count;
+
+	// Bytes an entry holds, including its share of the index and the
+	// natives it may be given later
+	static std::size_t weigh(const entry & e)
+	{
+		std::size_t n = sizeof(entry) + 4 * sizeof(void *) + e.line.capacity() + e.results.capacity() * sizeof(long long)
+			+ e.programs.size() * sizeof(native_fn);
+		for(const program & p : e.programs)
+		{
+			n += sizeof(program) + p.code.capacity() * sizeof(instruction) + p.constants.capacity() * sizeof(long long);
+		}
+		return n;
+	}
+
+	// Releases the native code of an entry
+	void release(entry & e)
+	{
+		for(native_fn f : e.natives)
+		{
+			if(f)
+			{
+				code->drop(f);
+			}
+		}
+		e.natives.clear();
+	}
+
+	void evict(std::size_t i)
+	{
+		entry & e = entries[i];
+		index.erase(e.hash);
+		total -= e.bytes;
+		release(e);
+		e = entry();
+		unused.push_back(i);
+		++eviction_count;
+	}
+
+	// Advances the hand until bytes more fit under the cap
+	void make_room(std::size_t bytes)
+	{
+		while(total + bytes > cap && !index.empty())
+		{
+			hand = (hand + 1) % entries.size();
+			entry & e = entries[hand];
+			if(e.bytes == 0)
+			{
+				continue;
+			}
+			if(e.used)
+			{
+				e.used = false;
+				continue;
+			}
+			evict(hand);
+		}
+	}
+
+public:
+	// Holds at most cap bytes of entries, with native code compiled by code
+	line_cache(std::size_t cap, jit * code) : code(code), hand(0), total(0), cap(cap), hit_count(0), miss_count(0), eviction_count(0) { }
+	~line_cache()
+	{
+		for(entry & e : entries)
+		{
+			release(e);
+		}
+	}
+
+	line_cache(const line_cache &) = delete;
+	line_cache & operator=(const line_cache &) = delete;
+
+	// Returns the entry for line, or nullptr if it is not cached or was
+	// parsed with bindings other than those of epoch
+	entry * find(std::uint64_t hash, std::string_view line, unsigned epoch)
+	{
+		std::unordered_map<std::uint64_t, std::size_t>::iterator it = index.find(hash);
+		if(it == index.end() || entries[it->second].line != line
+			|| !(entries[it->second].constant || entries[it->second].epoch == epoch))
+		{
+			++miss_count;
+			return nullptr;
+		}
+
+		entry & e = entries[it->second];
+		e.used = true;
+		++hit_count;
+		return & e;
+	}
+
+	// Caches e, which must hold the line, hash and what it parsed to
+	// An entry larger than the cap is dropped
+	void insert(entry && e)
+	{
+		e.bytes = weigh(e);
+		e.used = false;
+		if(e.bytes > cap)
+		{
+			return;
+		}
+
+		// A line with the same hash is replaced
+		std::unordered_map<std::uint64_t, std::size_t>::iterator it = index.find(e.hash);
+		if(it != index.end())
+		{
+			evict(it->second);
+		}
+		make_room(e.bytes);
+
+		std::size_t i;
+		if(unused.empty())
+		{
+			i = entries.size();
+			entries.push_back(std::move(e));
+		}
+		else
+		{
+			i = unused.back();
+			unused.pop_back();
+			entries[i] = std::move(e);
+		}
+		total += entries[i].bytes;
+		index.emplace(entries[i].hash, i);
+	}
+
+	// Number of lines found, not found and evicted since construction
+	std::size_t hits() const { return hit_count; }
+	std::size_t misses() const { return miss_count; }
+	std::size_t evictions() const { return eviction_count; }
+
+	// Most bytes the cache holds
+	std::size_t capacity() const { return cap; }
+
+	// Lines and bytes currently cached
+	std::size_t size() const { return index.size(); }
+	std::size_t bytes() const { return total; }
+};
+
+// Hashes a line eight bytes at a time
+std::uint64_t hash_line(std::string_view s)
+{
+	const std::uint64_t k = 0x9e3779b97f4a7c15ull;
+	std::uint64_t h = s.size() * k;
+	std::size_t i = 0;
+	std::uint64_t w;
+
+	for(; i + 8 <= s.size(); i += 8)
+	{
+		std::memcpy(& w, s.data() + i, 8);
+		h = (h ^ w) * k;
+		h ^= h >> 32;
+	}
+
+	w = 0;
+	std::memcpy(& w, s.data() + i, s.size() - i);
+	h = (h ^ w) * k;
+	return h ^ (h >> 29);
+}
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef CODEGEN_HPP
+#define CODEGEN_HPP
+
+# include <algorithm>
+# include <climits>
+# include <string>
+# include <vector>
+
+# include "ast/expression.hpp"
+# include "ast/statement.hpp"
+# include "ast/declaration.hpp"
+# include "com/writer.hpp"
+
+// *************************************************************************** //
+// C code generation
+//
+// Summary:
+//		- emit_c() writes a C translation unit that prints the value of
+//			each statement, one per line, like parser::parse() does. It is
+//			built with any C compiler, so a program is parsed once and then
+//			runs at native speed.
+//		- Each statement becomes a function that computes its expression
+//			in three address form, one temporary per node. The generated
+//			code stays flat however deep the expression is nested.
+//		- Variables live in a static values array, indexed by the same
+//			slots as in the parser.
+//		- cond_expr, and_then_expr and or_else_expr become if statements so
+//			only the selected operand runs, as in eval().
+//		- Arithmetic is done on unsigned values so overflow wraps instead of
+//			being undefined. Division and remainder go through helpers that
+//			abort on the inputs the interpreter traps on. They are inline so
+//			a program without division compiles without warnings.
+//
+// *************************************************************************** //
+
+static const char * c_prelude =
+	"#include <limits.h>\n"
+	"#include <stdio.h>\n"
+	"#include <stdlib.h>\n"
+	"\n"
+	"typedef long long i64;\n"
+	"typedef unsigned long long u64;\n"
+	"\n"
+	"static inline void trap(void)\n"
+	"{\n"
+	"\tfputs(\"integer division trap\\n\", stderr);\n"
+	"\tabort();\n"
+	"}\n"
+	"\n"
+	"static inline i64 div_i64(i64 a, i64 b)\n"
+	"{\n"
+	"\tif(b == 0 || (a == LLONG_MIN && b == -1)) { trap(); }\n"
+	"\treturn a / b;\n"
+	"}\n"
+	"\n"
+	"static inline i64 rem_i64(i64 a, i64 b)\n"
+	"{\n"
+	"\tif(b == 0 || (a == LLONG_MIN && b == -1)) { trap(); }\n"
+	"\treturn a % b;\n"
+	"}\n"
+	"\n";
+
+static const char * c_main =
+	"int main(void)\n"
+	"{\n"
+	"\tsize_t i;\n"
+	"\tfor(i = 0; i < sizeof(statements) / sizeof(statements[0]); ++i)\n"
+	"\t{\n"
+	"\t\tprintf(\"%lld\\n\", statements[i]());\n"
+	"\t}\n"
+	"\treturn 0;\n"
+	"}\n";
+
+// Writes the statements as a C translation unit
+void emit_c(const std::vector<stmt *> & statements, writer & out)
+{
+	// Derived expression visitor class
+	// Appends the code of each expression to body and sets result to the
+	// temporary holding its value
+	class expression_emitter : public expr::visitor
+	{
+	public:
+		std::string body;
+		int temps;
+		int result;
+		int depth;
+		int slots;
+
+		expression_emitter() : temps(0), result(0), depth(1), slots(0) { }
+
+		std::string name(int t) { return "t" + std::to_string(t); }
+
+		std::string literal(long long val)
+		{
+			if(val == LLONG_MIN)
+			{
+				return "(-9223372036854775807LL - 1)";
+			}
+			return std::to_string(val) + "LL";
+		}
+
+		// Appends one indented line
+		void line(const std::string & s)
+		{
+			body.append(depth, '\t');
+			body += s;
+			body += '\n';
+		}
+
+		int run(expr * e)
+		{
+			e->accept(* this);
+			return result;
+		}
+
+		// Defines a new temporary as the value of s
+		void define(const std::string & s)
+		{
+			result = temps++;
+			line(name(result) + " = " + s + ";");
+		}
+
+		// Runs e inside an if block and copies its value to t
+		void branch(expr * e, int t)
+		{
+			++depth;
+			int r = run(e);
+			line(name(t) + " = " + name(r) + ";");
+			--depth;
+		}
+
+		void binary(expr * e1, expr * e2, const char * op)
+		{
+			int a = run(e1);
+			int b = run(e2);
+			define(name(a) + " " + op + " " + name(b));
+		}
+
+		void logical(expr * e1, expr * e2, const char * op)
+		{
+			int a = run(e1);
+			int b = run(e2);
+			define("(" + name(a) + " " + op + " " + name(b) + ") != 0");
+		}
+
+		void arithmetic(expr * e1, expr * e2, const char * op)
+		{
+			int a = run(e1);
+			int b = run(e2);
+			define("(i64)((u64)" + name(a) + " " + op + " (u64)" + name(b) + ")");
+		}
+
+		void call(expr * e1, expr * e2, const char * fn)
+		{
+			int a = run(e1);
+			int b = run(e2);
+			define(std::string(fn) + "(" + name(a) + ", " + name(b) + ")");
+		}
+
+		void visit(bool_expr * e) { define(literal(convert(e->val))); }
+		void visit(int_expr * e) { define(literal(e->val)); }
+		void visit(ref_expr * e)
+		{
+			define("values[" + std::to_string(e->slot) + "]");
+			slots = std::max(slots, e->slot + 1);
+		}
+		void visit(and_expr * e) { logical(e->e1, e->e2, "&"); }
+		void visit(or_expr * e) { logical(e->e1, e->e2, "|"); }
+		void visit(xor_expr * e) { logical(e->e1, e->e2, "^"); }
+		void visit(not_expr * e) { define("!" + name(run(e->e))); }
+		void visit(cond_expr * e)
+		{
+			int a = run(e->e1);
+			int t = temps++;
+			line("if(" + name(a) + ")");
+			line("{");
+			branch(e->e2, t);
+			line("}");
+			line("else");
+			line("{");
+			branch(e->e3, t);
+			line("}");
+			result = t;
+		}
+		void visit(equal_expr * e) { binary(e->e1, e->e2, "=="); }
+		void visit(not_equal_expr * e) { binary(e->e1, e->e2, "!="); }
+		void visit(less_than_expr * e) { binary(e->e1, e->e2, "<"); }
+		void visit(greater_than_expr * e) { binary(e->e1, e->e2, ">"); }
+		void visit(less_than_eq_expr * e) { binary(e->e1, e->e2, "<="); }
+		void visit(greater_than_eq_expr * e) { binary(e->e1, e->e2, ">="); }
+		void visit(add_expr * e) { arithmetic(e->e1, e->e2, "+"); }
+		void visit(sub_expr * e) { arithmetic(e->e1, e->e2, "-"); }
+		void visit(multi_expr * e) { arithmetic(e->e1, e->e2, "*"); }
+		void visit(div_expr * e) { call(e->e1, e->e2, "div_i64"); }
+		void visit(rem_expr * e) { call(e->e1, e->e2, "rem_i64"); }
+		void visit(neg_expr * e) { define("(i64)(0 - (u64)" + name(run(e->e)) + ")"); }
+		void visit(and_then_expr * e)
+		{
+			// e1 == 1 ? e2 : false
+			int a = run(e->e1);
+			int t = temps++;
+			line("if(" + name(a) + " == 1)");
+			line("{");
+			branch(e->e2, t);
+			line("}");
+			line("else");
+			line("{");
+			line("\t" + name(t) + " = 0;");
+			line("}");
+			result = t;
+		}
+		void visit(or_else_expr * e)
+		{
+			// e1 when it is non zero, else e2
+			int a = run(e->e1);
+			int t = temps++;
+			line(name(t) + " = " + name(a) + ";");
+			line("if(" + name(t) + " == 0)");
+			line("{");
+			branch(e->e2, t);
+			line("}");
+			result = t;
+		}
+	};
+
+	// Derived statement visitor class
+	// Appends each statement to code as a function returning its value
+	class statement_emitter : public stmt::visitor
+	{
+	public:
+		std::string code;
+		int index;
+		int slots;
+
+		statement_emitter() : index(0), slots(0) { }
+
+		void function(const std::string & body, int temps, const std::string & value)
+		{
+			code += "static i64 s" + std::to_string(index++) + "(void)\n{\n";
+			for(int i = 0; i < temps; ++i)
+			{
+				code += (i == 0 ? "\ti64 t" : ", t") + std::to_string(i);
+			}
+			if(temps > 0)
+			{
+				code += ";\n";
+			}
+			code += body;
+			code += "\treturn " + value + ";\n}\n\n";
+		}
+
+		void visit(expr_stmt * s)
+		{
+			expression_emitter em;
+			int r = em.run(s->e);
+			function(em.body, em.temps, em.name(r));
+			slots = std::max(slots, em.slots);
+		}
+
+		void visit(decl_stmt * s)
+		{
+			// var_decl is the only declaration
+			var_decl * v = static_cast<var_decl *>(s->d);
+			expression_emitter em;
+			int r = em.run(v->e);
+			std::string slot = "values[" + std::to_string(v->slot) + "]";
+			em.line(slot + " = " + em.name(r) + ";");
+			function(em.body, em.temps, slot);
+			slots = std::max(slots, std::max(em.slots, v->slot + 1));
+		}
+	};
+
+	if(statements.empty())
+	{
+		out.put("int main(void)\n{\n\treturn 0;\n}\n");
+		return;
+	}
+
+	statement_emitter em;
+	for(stmt * s : statements)
+	{
+		s->accept(em);
+	}
+
+	out.put(c_prelude);
+	if(em.slots > 0)
+	{
+		out.put("static i64 values[");
+		out.put_int(em.slots);
+		out.put("];\n\n");
+	}
+	out.put(em.code);
+
+	out.put("static i64 (* const statements[])(void) =\n{\n");
+	for(int i = 0; i < em.index; ++i)
+	{
+		out.put("\ts");
+		out.put_int(i);
+		out.put(",\n");
+	}
+	out.put("};\n\n");
+	out.put(c_main);
+}
+
+#endif
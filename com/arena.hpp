@@ -0,0 +1,124 @@
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+// *************************************************************************** //
+// Arena class
+// 
+// Summary:
+//		- Bump allocator that backs the syntax tree nodes created while
+//			parsing.
+//		- make() carves objects out of large blocks by advancing a pointer.
+//		- reset() releases every object at once by rewinding to the first
+//			block. Blocks are kept for reuse, so a parser that has warmed up
+//			does not call malloc at all.
+//		- Destructors of arena objects are never run, so they must not
+//			own any other heap memory.
+// 
+// *************************************************************************** //
+class arena
+{
+private:
+	struct block
+	{
+		char * data;
+		std::size_t size;
+	};
+
+	static const std::size_t block_size = 64 * 1024;
+
+	std::vector<block> blocks;
+	std::size_t index;
+	char * current;
+	char * last;
+	std::size_t total;
+
+	static char * align(char * p, std::size_t a)
+	{
+		return reinterpret_cast<char *>((reinterpret_cast<std::size_t>(p) + a - 1) & ~(a - 1));
+	}
+
+	void grow(std::size_t);
+
+public:
+	// Default Constructor and Destructor
+	arena() : index(0), current(nullptr), last(nullptr), total(0) { }
+	~arena()
+	{
+		for(block & b : blocks)
+		{
+			::operator delete(b.data);
+		}
+	}
+
+	arena(const arena &) = delete;
+	arena & operator=(const arena &) = delete;
+
+	// Allocates size bytes aligned to a
+	void * allocate(std::size_t size, std::size_t a)
+	{
+		char * p = align(current, a);
+		if(current == nullptr || p + size > last)
+		{
+			grow(size + a);
+			p = align(current, a);
+		}
+
+		current = p + size;
+		return p;
+	}
+
+	// Constructs a T in the arena
+	template<typename T, typename... Args>
+	T * make(Args &&... args)
+	{
+		return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	// Releases every object allocated since the last reset
+	void reset()
+	{
+		index = 0;
+		current = blocks.empty() ? nullptr : blocks[0].data;
+		last = blocks.empty() ? nullptr : blocks[0].data + blocks[0].size;
+	}
+
+	// Exchanges the blocks and objects of two arenas
+	void swap(arena & a)
+	{
+		blocks.swap(a.blocks);
+		std::swap(index, a.index);
+		std::swap(current, a.current);
+		std::swap(last, a.last);
+		std::swap(total, a.total);
+	}
+
+	// Total bytes held by the arena's blocks
+	std::size_t reserved() const { return total; }
+};
+
+// Moves to the next block that can hold n bytes, allocating one if needed
+void arena::grow(std::size_t n)
+{
+	std::size_t next = blocks.empty() ? 0 : index + 1;
+
+	if(next >= blocks.size() || blocks[next].size < n)
+	{
+		block b;
+		b.size = n > block_size ? n : block_size;
+		b.data = static_cast<char *>(::operator new(b.size));
+		blocks.insert(blocks.begin() + next, b);
+		total += b.size;
+	}
+
+	index = next;
+	current = blocks[index].data;
+	last = blocks[index].data + blocks[index].size;
+}
+
+#endif
@@ -0,0 +1,183 @@
+
+#ifndef CHARCLASS_HPP
+#define CHARCLASS_HPP
+
+#include <cstddef>
+#include "com/simd.hpp"
+
+// *************************************************************************** //
+// Character classification
+// 
+// Summary:
+//		- char_classes is a 256 entry table built at compile time that maps
+//			each byte to a set of class bits, so classifying a character
+//			is one load and one test. It also holds each byte's digit value.
+//		- skip_space(), scan_digits() and scan_word() return the end of a
+//			run of characters of one class. With SSE2 or AVX2 they test 16
+//			or 32 bytes per step and finish the tail with the table.
+//		- The _scalar versions only use the table. They are the fallback
+//			when no vector unit is available and the baseline for the
+//			lexer benchmark.
+// 
+// *************************************************************************** //
+enum char_class : unsigned char
+{
+	cc_space = 1,	// blanks between tokens, newlines are tokens
+	cc_digit = 2,
+	cc_hex = 4,		// digits and upper case A to F
+	cc_alpha = 8,
+	cc_word = 16	// letters, digits and underscores
+};
+
+struct char_class_table
+{
+	unsigned char bits[256];
+	unsigned char values[256];
+
+	constexpr char_class_table() : bits(), values()
+	{
+		for(int c = 0; c < 256; ++c)
+		{
+			unsigned char b = 0;
+			if(c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f') b |= cc_space;
+			if(c >= '0' && c <= '9') b |= cc_digit | cc_hex | cc_word;
+			if(c >= 'A' && c <= 'F') b |= cc_hex;
+			if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) b |= cc_alpha | cc_word;
+			if(c == '_') b |= cc_word;
+			bits[c] = b;
+
+			// Digit values of decimal, binary and upper case hex digits
+			values[c] = c >= '0' && c <= '9' ? c - '0' : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 0xFF;
+		}
+	}
+};
+
+constexpr char_class_table char_classes;
+
+// Tests whether c belongs to any of the classes in mask
+inline bool is_class(char c, unsigned char mask)
+{
+	return (char_classes.bits[static_cast<unsigned char>(c)] & mask) != 0;
+}
+
+// Value of c as a digit, 0xFF if it is not one
+inline unsigned digit_value(char c)
+{
+	return char_classes.values[static_cast<unsigned char>(c)];
+}
+
+// Returns the first character in [p, end) outside of the classes in mask
+inline const char * scan_scalar(const char * p, const char * end, unsigned char mask)
+{
+	while(p < end && is_class(*p, mask))
+	{
+		++p;
+	}
+	return p;
+}
+
+inline const char * skip_space_scalar(const char * p, const char * end) { return scan_scalar(p, end, cc_space); }
+inline const char * scan_digits_scalar(const char * p, const char * end) { return scan_scalar(p, end, cc_digit); }
+inline const char * scan_word_scalar(const char * p, const char * end) { return scan_scalar(p, end, cc_word); }
+
+#if UA_SIMD_WIDTH
+
+// Index of the lowest set bit of a non zero mask
+inline unsigned first_bit(unsigned mask)
+{
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward(& i, mask);
+	return i;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+#if UA_SIMD_WIDTH == 32
+typedef __m256i simd_t;
+inline simd_t simd_load(const char * p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+inline simd_t simd_set(char c) { return _mm256_set1_epi8(c); }
+inline simd_t simd_eq(simd_t a, simd_t b) { return _mm256_cmpeq_epi8(a, b); }
+inline simd_t simd_gt(simd_t a, simd_t b) { return _mm256_cmpgt_epi8(a, b); }
+inline simd_t simd_and(simd_t a, simd_t b) { return _mm256_and_si256(a, b); }
+inline simd_t simd_or(simd_t a, simd_t b) { return _mm256_or_si256(a, b); }
+inline unsigned simd_mask(simd_t a) { return static_cast<unsigned>(_mm256_movemask_epi8(a)); }
+#else
+typedef __m128i simd_t;
+inline simd_t simd_load(const char * p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+inline simd_t simd_set(char c) { return _mm_set1_epi8(c); }
+inline simd_t simd_eq(simd_t a, simd_t b) { return _mm_cmpeq_epi8(a, b); }
+inline simd_t simd_gt(simd_t a, simd_t b) { return _mm_cmpgt_epi8(a, b); }
+inline simd_t simd_and(simd_t a, simd_t b) { return _mm_and_si128(a, b); }
+inline simd_t simd_or(simd_t a, simd_t b) { return _mm_or_si128(a, b); }
+inline unsigned simd_mask(simd_t a) { return static_cast<unsigned>(_mm_movemask_epi8(a)) ; }
+#endif
+
+const unsigned simd_all = UA_SIMD_WIDTH == 32 ? 0xFFFFFFFFu : 0xFFFFu;
+
+// Lanes of v in the range [lo, hi], bytes above 0x7F never match
+inline simd_t simd_range(simd_t v, char lo, char hi)
+{
+	return simd_and(simd_gt(v, simd_set(lo - 1)), simd_gt(simd_set(hi + 1), v));
+}
+
+// Scans whole vectors while every lane is in the class computed by test
+// Returns the first character outside the class, or the point where fewer
+// than a vector's worth of characters remain
+template<typename Test>
+inline const char * scan_vector(const char * p, const char * end, Test test)
+{
+	while(end - p >= UA_SIMD_WIDTH)
+	{
+		unsigned mask = simd_mask(test(simd_load(p))) ^ simd_all;
+		if(mask != 0)
+		{
+			return p + first_bit(mask);
+		}
+		p += UA_SIMD_WIDTH;
+	}
+	return p;
+}
+
+inline const char * skip_space(const char * p, const char * end)
+{
+	// Single blanks are the common case, skip the vector setup for them
+	if(p < end && !is_class(*p, cc_space))
+	{
+		return p;
+	}
+
+	p = scan_vector(p, end, [](simd_t v)
+	{
+		return simd_or(simd_or(simd_eq(v, simd_set(' ')), simd_eq(v, simd_set('\t'))), simd_range(v, '\v', '\r'));
+	});
+	return skip_space_scalar(p, end);
+}
+
+inline const char * scan_digits(const char * p, const char * end)
+{
+	p = scan_vector(p, end, [](simd_t v) { return simd_range(v, '0', '9'); });
+	return scan_digits_scalar(p, end);
+}
+
+inline const char * scan_word(const char * p, const char * end)
+{
+	p = scan_vector(p, end, [](simd_t v)
+	{
+		// Setting bit 5 folds upper case letters onto lower case ones
+		simd_t lower = simd_or(v, simd_set(0x20));
+		return simd_or(simd_or(simd_range(lower, 'a', 'z'), simd_range(v, '0', '9')), simd_eq(v, simd_set('_')));
+	});
+	return scan_word_scalar(p, end);
+}
+
+#else
+
+inline const char * skip_space(const char * p, const char * end) { return skip_space_scalar(p, end); }
+inline const char * scan_digits(const char * p, const char * end) { return scan_digits_scalar(p, end); }
+inline const char * scan_word(const char * p, const char * end) { return scan_word_scalar(p, end); }
+
+#endif
+
+#endif
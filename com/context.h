@@ -7,6 +7,9 @@
 // 
 // Summary:
 //		- Holds a reference for all possible types in the language.
+//		- types() returns the one context every parser shares. The types
+//			carry no state and are never written, so parsers on different
+//			threads can compare against them without locking.
 // 
 // *************************************************************************** //
 class context
@@ -21,4 +24,11 @@ public:
 	int_type int_type;
 };
 
+// Returns the shared context, built on first use
+inline context & types()
+{
+	static context c;
+	return c;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef INTERNER_HPP
+#define INTERNER_HPP
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// *************************************************************************** //
+// Interner class
+// 
+// Summary:
+//		- Maps each distinct string to a small integer id, assigned in the
+//			order the strings are first seen, so names can be compared and
+//			used as indices instead of being hashed again.
+//		- Strings are copied once into storage that never moves, so the
+//			views returned by name() stay valid for the interner's lifetime.
+// 
+// *************************************************************************** //
+class interner
+{
+private:
+	std::deque<std::string> strings;
+	std::vector<std::string_view> names;
+	std::unordered_map<std::string_view, unsigned> ids;
+
+public:
+	interner() { }
+	~interner() { }
+
+	interner(const interner &) = delete;
+	interner & operator=(const interner &) = delete;
+
+	// Returns the id of s, adding it if it is new
+	unsigned intern(std::string_view s)
+	{
+		std::unordered_map<std::string_view, unsigned>::iterator it = ids.find(s);
+		if(it != ids.end())
+		{
+			return it->second;
+		}
+
+		strings.emplace_back(s);
+		std::string_view v = strings.back();
+		unsigned id = static_cast<unsigned>(names.size());
+		names.push_back(v);
+		ids.emplace(v, id);
+		return id;
+	}
+
+	std::string_view name(unsigned id) const { return names[id]; }
+	std::size_t size() const { return names.size(); }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef RING_HPP
+#define RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+// *************************************************************************** //
+// Ring buffer class
+//
+// Summary:
+//		- Bounded queue of N items between exactly one producer thread and
+//			one consumer thread, with no locks: each side only writes its
+//			own index and reads the other's.
+//		- The indices count up forever and are masked into the array, so a
+//			full ring is told from an empty one by their difference. N must
+//			be a power of two.
+//		- The indices sit on separate cache lines so the two threads do
+//			not invalidate each other's line on every operation.
+//		- push() and pop() wait while the ring is full or empty, which is
+//			how a slow stage holds back the stage feeding it.
+//
+// *************************************************************************** //
+template<typename T, std::size_t N>
+class spsc_ring
+{
+private:
+	static_assert(N != 0 && (N & (N - 1)) == 0, "spsc_ring size must be a power of two");
+
+	T items[N];
+	alignas(64) std::atomic<std::size_t> head;
+	alignas(64) std::atomic<std::size_t> tail;
+
+	// Spins briefly, then gives the core to the thread being waited on
+	static void pause(unsigned & spins)
+	{
+		if(++spins > 64)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+public:
+	spsc_ring() : head(0), tail(0) { }
+
+	spsc_ring(const spsc_ring &) = delete;
+	spsc_ring & operator=(const spsc_ring &) = delete;
+
+	// Producer side, returns false if the ring is full
+	bool try_push(const T & item)
+	{
+		std::size_t t = tail.load(std::memory_order_relaxed);
+		if(t - head.load(std::memory_order_acquire) == N)
+		{
+			return false;
+		}
+		items[t & (N - 1)] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, returns false if the ring is empty
+	bool try_pop(T & item)
+	{
+		std::size_t h = head.load(std::memory_order_relaxed);
+		if(h == tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		item = items[h & (N - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	void push(const T & item)
+	{
+		for(unsigned spins = 0; !try_push(item); )
+		{
+			pause(spins);
+		}
+	}
+
+	T pop()
+	{
+		T item;
+		for(unsigned spins = 0; !try_pop(item); )
+		{
+			pause(spins);
+		}
+		return item;
+	}
+};
+
+#endif
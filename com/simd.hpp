@@ -0,0 +1,36 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+// *************************************************************************** //
+// SIMD support
+// 
+// Summary:
+//		- UA_SIMD_WIDTH is the width in bytes of the vectors the compiler
+//			targets: 32 with AVX2, 16 with SSE2, 0 when neither is enabled.
+//		- UA_SIMD_COMPARE is 1 when 64 bit lanes can be compared in a
+//			vector (AVX2, or SSE4.2 for 16 byte vectors).
+// 
+// *************************************************************************** //
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define UA_SIMD_WIDTH 32
+#define UA_SIMD_COMPARE 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UA_SIMD_WIDTH 16
+#if defined(__SSE4_2__) || defined(__AVX__)
+#include <nmmintrin.h>
+#define UA_SIMD_COMPARE 1
+#else
+#define UA_SIMD_COMPARE 0
+#endif
+#else
+#define UA_SIMD_WIDTH 0
+#define UA_SIMD_COMPARE 0
+#endif
+
+#if UA_SIMD_WIDTH && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#endif
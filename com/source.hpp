@@ -0,0 +1,135 @@
+
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include <cstddef>
+#include <exception>
+#include <string_view>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// *************************************************************************** //
+// Mapped file class
+// 
+// Summary:
+//		- Maps a whole input file into memory read only.
+//		- view() exposes the contents as a std::string_view, so the lexer
+//			reads the file directly without copying it into strings.
+//		- The mapping is released when the object is destroyed.
+// 
+// *************************************************************************** //
+class mapped_file
+{
+private:
+	const char * data;
+	std::size_t size;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+public:
+	mapped_file(const char *);
+	~mapped_file();
+
+	mapped_file(const mapped_file &) = delete;
+	mapped_file & operator=(const mapped_file &) = delete;
+
+	std::string_view view() const { return std::string_view(data, size); }
+};
+
+#ifdef _WIN32
+
+mapped_file::mapped_file(const char * path) : data(nullptr), size(0), file(INVALID_HANDLE_VALUE), mapping(nullptr)
+{
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		throw std::exception("Unable to open input file");
+	}
+
+	LARGE_INTEGER n;
+	GetFileSizeEx(file, & n);
+	size = static_cast<std::size_t>(n.QuadPart);
+
+	// Empty files cannot be mapped
+	if(size == 0)
+	{
+		return;
+	}
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	data = mapping ? static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+	if(data == nullptr)
+	{
+		throw std::exception("Unable to map input file");
+	}
+}
+
+mapped_file::~mapped_file()
+{
+	if(data)
+	{
+		UnmapViewOfFile(data);
+	}
+	if(mapping)
+	{
+		CloseHandle(mapping);
+	}
+	if(file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+	}
+}
+
+#else
+
+mapped_file::mapped_file(const char * path) : data(nullptr), size(0)
+{
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		throw std::exception("Unable to open input file");
+	}
+
+	struct stat st;
+	fstat(fd, & st);
+	size = static_cast<std::size_t>(st.st_size);
+
+	// Empty files cannot be mapped
+	if(size > 0)
+	{
+		void * p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p == MAP_FAILED)
+		{
+			close(fd);
+			throw std::exception("Unable to map input file");
+		}
+
+		// The file is lexed front to back exactly once
+		madvise(p, size, MADV_SEQUENTIAL);
+		data = static_cast<const char *>(p);
+	}
+
+	close(fd);
+}
+
+mapped_file::~mapped_file()
+{
+	if(data)
+	{
+		munmap(const_cast<char *>(data), size);
+	}
+}
+
+#endif
+
+#endif
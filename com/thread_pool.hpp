@@ -0,0 +1,120 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// *************************************************************************** //
+// Thread pool class
+//
+// Summary:
+//		- A fixed set of worker threads started once and kept for the life
+//			of the pool, so running a batch of work does not create threads.
+//		- run() hands out the items of a batch from a shared counter, so a
+//			thread that finishes early takes the next item instead of
+//			waiting on a slower one.
+//		- Each call is told which worker runs it, which lets the caller keep
+//			per thread state such as a parser in an array indexed by worker.
+//		- The calls must not throw; the caller catches and stores errors.
+//
+// *************************************************************************** //
+class thread_pool
+{
+private:
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	// The batch being run, set under lock by run()
+	std::function<void(std::size_t, std::size_t)> task;
+	std::atomic<std::size_t> next;
+	std::size_t items;
+	std::size_t busy;
+	unsigned long long batch;
+	bool stopping;
+
+	void work(std::size_t);
+
+public:
+	// Starts n workers, one per hardware thread by default
+	thread_pool(std::size_t n = std::thread::hardware_concurrency()) : next(0), items(0), busy(0), batch(0), stopping(false)
+	{
+		n = std::max<std::size_t>(n, 1);
+		for(std::size_t i = 0; i < n; ++i)
+		{
+			threads.emplace_back(& thread_pool::work, this, i);
+		}
+	}
+
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> l(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for(std::thread & t : threads)
+		{
+			t.join();
+		}
+	}
+
+	thread_pool(const thread_pool &) = delete;
+	thread_pool & operator=(const thread_pool &) = delete;
+
+	// Number of worker threads
+	std::size_t size() const { return threads.size(); }
+
+	// Calls f(item, worker) for every item in [0, n) on the workers
+	// Returns once every call has returned
+	void run(std::size_t n, std::function<void(std::size_t, std::size_t)> f)
+	{
+		std::unique_lock<std::mutex> l(lock);
+		task = std::move(f);
+		items = n;
+		next = 0;
+		busy = threads.size();
+		++batch;
+		wake.notify_all();
+		done.wait(l, [this] { return busy == 0; });
+	}
+};
+
+// Worker loop: waits for a batch, takes items until none are left, then
+// reports that it is idle
+void thread_pool::work(std::size_t worker)
+{
+	unsigned long long seen = 0;
+	std::unique_lock<std::mutex> l(lock);
+
+	while(true)
+	{
+		wake.wait(l, [&] { return stopping || batch != seen; });
+		if(stopping)
+		{
+			return;
+		}
+		seen = batch;
+
+		l.unlock();
+		for(std::size_t i; (i = next++) < items; )
+		{
+			task(i, worker);
+		}
+		l.lock();
+
+		if(--busy == 0)
+		{
+			done.notify_one();
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,82 @@
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdio>
+#include <vector>
+#include "ast/token.hpp"
+
+// *************************************************************************** //
+// Tracing
+// 
+// Summary:
+//		- The parser and the statement evaluators report each rule they
+//			enter through trace().
+//		- Tracing is compiled in only when UA_TRACE is defined. Otherwise
+//			trace_enabled is false and the body of trace() is discarded at
+//			compile time, so normal builds do no I/O while parsing.
+//		- When enabled, events are recorded in a per thread trace_sink and
+//			written to stderr in batches, one tab separated line per event
+//			holding the rule name, the lookahead token and its position.
+// 
+// *************************************************************************** //
+#ifdef UA_TRACE
+constexpr bool trace_enabled = true;
+#else
+constexpr bool trace_enabled = false;
+#endif
+
+struct trace_event
+{
+	const char * name;
+	token_kind kind;
+	unsigned pos;
+};
+
+class trace_sink
+{
+private:
+	static const std::size_t batch_size = 4096;
+	std::vector<trace_event> events;
+
+public:
+	trace_sink() { events.reserve(batch_size); }
+	~trace_sink() { flush(); }
+
+	void record(const char * name, token_kind kind, unsigned pos)
+	{
+		events.push_back({ name, kind, pos });
+		if(events.size() >= batch_size)
+		{
+			flush();
+		}
+	}
+
+	// Writes the recorded events to stderr
+	void flush()
+	{
+		for(const trace_event & e : events)
+		{
+			std::fprintf(stderr, "%s\t%s\t%u\n", e.name, token_kind_strs[e.kind], e.pos);
+		}
+		events.clear();
+	}
+};
+
+// Trace sink of the calling thread
+trace_sink & get_trace_sink()
+{
+	static thread_local trace_sink sink;
+	return sink;
+}
+
+// Records a trace event, compiled out unless UA_TRACE is defined
+inline void trace(const char * name, token_kind kind = eof, unsigned pos = 0)
+{
+	if constexpr (trace_enabled)
+	{
+		get_trace_sink().record(name, kind, pos);
+	}
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef WORK_POOL_HPP
+#define WORK_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// *************************************************************************** //
+// Work stealing pool class
+//
+// Summary:
+//		- Runs fork / join work: a task spawned by a worker goes on that
+//			worker's own queue, and wait() keeps running queued tasks until
+//			the one it waits for is done.
+//		- A worker takes its own newest task first, which keeps it on the
+//			part of the work it was already doing. An idle worker steals
+//			the oldest task of another queue, which is the largest piece of
+//			work left there.
+//		- execute() makes the calling thread worker 0 for the duration of
+//			the call. The other workers sleep between calls and spin only
+//			while one is running.
+//		- Tasks live on the stack of whoever spawned them and must not
+//			throw, since their spawner has to wait for them before
+//			returning.
+//
+// *************************************************************************** //
+class work_pool
+{
+public:
+	// Unit of work, done is set once run() has returned
+	class task
+	{
+	public:
+		std::atomic<bool> done;
+
+		task() : done(false) { }
+		virtual ~task() = default;
+
+		virtual void run() = 0;
+	};
+
+private:
+	struct queue
+	{
+		std::mutex lock;
+		std::deque<task *> tasks;
+	};
+
+	std::vector<std::thread> threads;
+	std::unique_ptr<queue[]> queues;
+	std::size_t count;
+	std::mutex lock;
+	std::mutex calls;
+	std::condition_variable wake;
+	std::atomic<bool> running;
+	bool stopping;
+
+	// Worker index of the calling thread
+	static std::size_t & self()
+	{
+		static thread_local std::size_t index = 0;
+		return index;
+	}
+
+	// Newest task of queue i
+	task * pop(std::size_t i)
+	{
+		std::lock_guard<std::mutex> l(queues[i].lock);
+		if(queues[i].tasks.empty())
+		{
+			return nullptr;
+		}
+		task * t = queues[i].tasks.back();
+		queues[i].tasks.pop_back();
+		return t;
+	}
+
+	// Oldest task of the first other queue that has one
+	task * steal(std::size_t i)
+	{
+		for(std::size_t k = 1; k < count; ++k)
+		{
+			queue & q = queues[(i + k) % count];
+			std::lock_guard<std::mutex> l(q.lock);
+			if(!q.tasks.empty())
+			{
+				task * t = q.tasks.front();
+				q.tasks.pop_front();
+				return t;
+			}
+		}
+		return nullptr;
+	}
+
+	// Runs one queued task, returns false if there was none
+	bool help(std::size_t i)
+	{
+		task * t = pop(i);
+		if(t == nullptr)
+		{
+			t = steal(i);
+		}
+		if(t == nullptr)
+		{
+			return false;
+		}
+		t->run();
+		t->done.store(true, std::memory_order_release);
+		return true;
+	}
+
+	void work(std::size_t);
+
+public:
+	// Uses n workers including the thread calling execute()
+	work_pool(std::size_t n = std::thread::hardware_concurrency())
+		: count(std::max<std::size_t>(n, 1)), running(false), stopping(false)
+	{
+		queues.reset(new queue[count]);
+		for(std::size_t i = 1; i < count; ++i)
+		{
+			threads.emplace_back(& work_pool::work, this, i);
+		}
+	}
+
+	~work_pool()
+	{
+		{
+			std::lock_guard<std::mutex> l(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for(std::thread & t : threads)
+		{
+			t.join();
+		}
+	}
+
+	work_pool(const work_pool &) = delete;
+	work_pool & operator=(const work_pool &) = delete;
+
+	// Number of workers, counting the calling thread
+	std::size_t size() const { return count; }
+
+	// Queues t to be run by this worker or stolen by another
+	// Must be called from inside execute()
+	void spawn(task * t)
+	{
+		queue & q = queues[self()];
+		std::lock_guard<std::mutex> l(q.lock);
+		q.tasks.push_back(t);
+	}
+
+	// Runs queued tasks until t is done
+	void wait(task * t)
+	{
+		std::size_t i = self();
+		while(!t->done.load(std::memory_order_acquire))
+		{
+			if(!help(i))
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// Calls f on the calling thread with the other workers stealing the
+	// tasks it spawns; calls from several threads take turns
+	template<typename F>
+	void execute(F f)
+	{
+		std::lock_guard<std::mutex> turn(calls);
+		std::size_t saved = self();
+		self() = 0;
+		{
+			std::lock_guard<std::mutex> l(lock);
+			running = true;
+		}
+		wake.notify_all();
+
+		f();
+
+		running = false;
+		self() = saved;
+	}
+};
+
+// Worker loop: sleeps until execute() starts, then runs and steals tasks
+// until it returns
+void work_pool::work(std::size_t i)
+{
+	self() = i;
+
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> l(lock);
+			wake.wait(l, [this] { return stopping || running; });
+			if(stopping)
+			{
+				return;
+			}
+		}
+
+		while(running)
+		{
+			if(!help(i))
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+}
+
+#endif
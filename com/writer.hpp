@@ -0,0 +1,167 @@
+
+#ifndef WRITER_HPP
+#define WRITER_HPP
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// *************************************************************************** //
+// Writer class
+// 
+// Summary:
+//		- Buffered output used for evaluation results and printed tokens.
+//		- Output collects in a 64 KiB buffer and reaches the file in a single
+//			fwrite when the buffer fills, on flush() or on destruction.
+//		- put_int() formats integers straight into the buffer, two decimal
+//			digits at a time, instead of going through itoa and a shared
+//			static buffer.
+//		- A writer made from a string appends its output to that string
+//			instead, so output produced on another thread can be collected
+//			and written later in order.
+// 
+// *************************************************************************** //
+class writer
+{
+private:
+	static const std::size_t capacity = 64 * 1024;
+
+	std::FILE * file;
+	std::string * text;
+	std::size_t size;
+	char buf[capacity];
+
+	void write(const char * p, std::size_t n)
+	{
+		if(text != nullptr)
+		{
+			text->append(p, n);
+		}
+		else
+		{
+			std::fwrite(p, 1, n, file);
+		}
+	}
+
+	void reserve(std::size_t n)
+	{
+		if(size + n > capacity)
+		{
+			flush();
+		}
+	}
+
+public:
+	writer(std::FILE * file = stdout) : file(file), text(nullptr), size(0) { }
+	writer(std::string * text) : file(nullptr), text(text), size(0) { }
+	~writer() { flush(); }
+
+	writer(const writer &) = delete;
+	writer & operator=(const writer &) = delete;
+
+	void put(char c)
+	{
+		reserve(1);
+		buf[size++] = c;
+	}
+
+	void put(std::string_view s)
+	{
+		if(s.size() > capacity)
+		{
+			flush();
+			write(s.data(), s.size());
+			return;
+		}
+
+		reserve(s.size());
+		std::memcpy(buf + size, s.data(), s.size());
+		size += s.size();
+	}
+
+	void put_int(long long, int = 10);
+
+	// Writes the buffered output to the file or string
+	void flush()
+	{
+		if(size > 0)
+		{
+			write(buf, size);
+			size = 0;
+		}
+		if(file != nullptr)
+		{
+			std::fflush(file);
+		}
+	}
+};
+
+// Writes val in the given base
+// Bases other than 10 print the bits of val as an unsigned number
+void writer::put_int(long long val, int base)
+{
+	static const char digits[] = "0123456789abcdef";
+	static const char pairs[] =
+		"00010203040506070809"
+		"10111213141516171819"
+		"20212223242526272829"
+		"30313233343536373839"
+		"40414243444546474849"
+		"50515253545556575859"
+		"60616263646566676869"
+		"70717273747576777879"
+		"80818283848586878889"
+		"90919293949596979899";
+
+	// Digits are produced back to front, 64 covers a binary long long
+	char tmp[65];
+	char * end = tmp + sizeof(tmp);
+	char * p = end;
+
+	unsigned long long u = static_cast<unsigned long long>(val);
+	bool negative = base == 10 && val < 0;
+	if(negative)
+	{
+		u = 0 - u;
+	}
+
+	if(base == 10)
+	{
+		while(u >= 100)
+		{
+			unsigned long long i = (u % 100) * 2;
+			u /= 100;
+			*--p = pairs[i + 1];
+			*--p = pairs[i];
+		}
+		if(u >= 10)
+		{
+			*--p = pairs[u * 2 + 1];
+			*--p = pairs[u * 2];
+		}
+		else
+		{
+			*--p = static_cast<char>('0' + u);
+		}
+	}
+	else
+	{
+		do
+		{
+			*--p = digits[u % base];
+			u /= base;
+		}
+		while(u != 0);
+	}
+
+	if(negative)
+	{
+		*--p = '-';
+	}
+
+	put(std::string_view(p, end - p));
+}
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef FOLD_HPP
+#define FOLD_HPP
+
+# include <climits>
+# include <unordered_map>
+
+# include "ast/expression.hpp"
+# include "com/arena.hpp"
+
+// *************************************************************************** //
+// Constant folding
+// 
+// Summary:
+//		- fold() rewrites an expression tree bottom up. Any expression whose
+//			sub expressions are all literals is replaced by the bool_expr or
+//			int_expr holding its value, computed with eval() so folding
+//			always agrees with evaluation.
+//		- It also applies the identities x + 0, 0 + x, x - 0, x * 1, 1 * x,
+//			x / 1, !!b and --x, and selects the operand of cond_expr,
+//			and_then_expr and or_else_expr when their first sub expression
+//			is a literal.
+//		- Division and remainder by a literal zero (or LLONG_MIN / -1) are
+//			left in place so they still fail when evaluated.
+//		- A node whose sub expressions changed is rebuilt in the arena, the
+//			others are returned as they are. Their operands and values are
+//			never modified.
+//		- Shared nodes of a DAG are folded once. Their result takes over
+//			the memo slot if it has none, since it has the same value; that
+//			is the one field folding writes to a node it returns.
+// 
+// *************************************************************************** //
+// Result of folding one expression
+struct folded
+{
+	expr * e;
+	bool constant;		// e is a literal
+	long long val;		// value of the literal
+	expr * inner;		// operand of e when e is a not_expr or neg_expr,
+						// the type check keeps the two from mixing
+};
+
+// Expression visitor that performs the folding
+// Each visit folds the sub expressions first and sets last
+class folder : public expr::visitor
+{
+public:
+	arena & arn;
+	folded last;
+	std::unordered_map<expr *, folded> done;
+
+	folder(arena & arn) : arn(arn) { }
+
+	folded run(expr * e)
+	{
+		if(e->memo < 0)
+		{
+			e->accept(* this);
+			return last;
+		}
+
+		auto it = done.find(e);
+		if(it != done.end())
+		{
+			return last = it->second;
+		}
+
+		e->accept(* this);
+		if(last.e->memo < 0)
+		{
+			last.e->memo = e->memo;
+		}
+		done.emplace(e, last);
+		return last;
+	}
+
+	void set(expr * e) { last = { e, false, 0, nullptr }; }
+
+	// Replaces an expression of type t by the literal val
+	void literal(type * t, long long val)
+	{
+		if(t == & types().bool_type)
+		{
+			last = { arn.make<bool_expr>(val != 0), true, convert(val != 0), nullptr };
+		}
+		else
+		{
+			last = { arn.make<int_expr>(val), true, val, nullptr };
+		}
+	}
+
+	// Folds a binary expression, returns false if it is left for
+	// the caller to apply identities to a and b
+	template<typename T>
+	bool binary(T * e, folded & a, folded & b)
+	{
+		a = run(e->e1);
+		b = run(e->e2);
+
+		if(a.constant && b.constant)
+		{
+			T tmp(a.e, b.e);
+			literal(e->t, eval(& tmp));
+			return true;
+		}
+
+		set(a.e == e->e1 && b.e == e->e2 ? e : arn.make<T>(a.e, b.e));
+		return false;
+	}
+
+	template<typename T>
+	void binary(T * e)
+	{
+		folded a, b;
+		binary(e, a, b);
+	}
+
+	// Division is only folded when it cannot fail
+	// x / 1 is x, but x % 1 is not
+	template<typename T>
+	void division(T * e, bool identity)
+	{
+		folded a = run(e->e1);
+		folded b = run(e->e2);
+
+		if(a.constant && b.constant && b.val != 0 && !(b.val == -1 && a.val == LLONG_MIN))
+		{
+			T tmp(a.e, b.e);
+			literal(e->t, eval(& tmp));
+		}
+		else if(identity && b.constant && b.val == 1)
+		{
+			last = a;
+		}
+		else
+		{
+			set(a.e == e->e1 && b.e == e->e2 ? e : arn.make<T>(a.e, b.e));
+		}
+	}
+
+	void visit(bool_expr * e) { last = { e, true, convert(e->val), nullptr }; }
+	void visit(int_expr * e) { last = { e, true, e->val, nullptr }; }
+	void visit(ref_expr * e) { set(e); }
+	void visit(and_expr * e) { binary(e); }
+	void visit(or_expr * e) { binary(e); }
+	void visit(xor_expr * e) { binary(e); }
+	void visit(not_expr * e)
+	{
+		folded a = run(e->e);
+		if(a.constant)
+		{
+			literal(e->t, !a.val);
+		}
+		else if(a.inner)
+		{
+			// !!b
+			set(a.inner);
+		}
+		else
+		{
+			set(a.e == e->e ? e : arn.make<not_expr>(a.e));
+			last.inner = a.e;
+		}
+	}
+	void visit(cond_expr * e)
+	{
+		folded a = run(e->e1);
+		if(a.constant)
+		{
+			run(a.val ? e->e2 : e->e3);
+			return;
+		}
+
+		folded b = run(e->e2);
+		folded c = run(e->e3);
+		set(a.e == e->e1 && b.e == e->e2 && c.e == e->e3 ? e : arn.make<cond_expr>(a.e, b.e, c.e));
+	}
+	void visit(equal_expr * e) { binary(e); }
+	void visit(not_equal_expr * e) { binary(e); }
+	void visit(less_than_expr * e) { binary(e); }
+	void visit(greater_than_expr * e) { binary(e); }
+	void visit(less_than_eq_expr * e) { binary(e); }
+	void visit(greater_than_eq_expr * e) { binary(e); }
+	void visit(add_expr * e)
+	{
+		folded a, b;
+		if(!binary(e, a, b))
+		{
+			if(a.constant && a.val == 0) { last = b; }
+			else if(b.constant && b.val == 0) { last = a; }
+		}
+	}
+	void visit(sub_expr * e)
+	{
+		folded a, b;
+		if(!binary(e, a, b) && b.constant && b.val == 0)
+		{
+			last = a;
+		}
+	}
+	void visit(multi_expr * e)
+	{
+		folded a, b;
+		if(!binary(e, a, b))
+		{
+			if(a.constant && a.val == 1) { last = b; }
+			else if(b.constant && b.val == 1) { last = a; }
+		}
+	}
+	void visit(div_expr * e) { division(e, true); }
+	void visit(rem_expr * e) { division(e, false); }
+	void visit(neg_expr * e)
+	{
+		folded a = run(e->e);
+		if(a.constant)
+		{
+			literal(e->t, 0 - static_cast<unsigned long long>(a.val));
+		}
+		else if(a.inner)
+		{
+			// --x
+			set(a.inner);
+		}
+		else
+		{
+			set(a.e == e->e ? e : arn.make<neg_expr>(a.e));
+			last.inner = a.e;
+		}
+	}
+	void visit(and_then_expr * e)
+	{
+		folded a = run(e->e1);
+		if(a.constant)
+		{
+			// false && b is false, true && b is b
+			if(a.val == 0) { literal(e->t, 0); } else { run(e->e2); }
+			return;
+		}
+
+		folded b = run(e->e2);
+		set(a.e == e->e1 && b.e == e->e2 ? e : arn.make<and_then_expr>(a.e, b.e));
+	}
+	void visit(or_else_expr * e)
+	{
+		folded a = run(e->e1);
+		if(a.constant)
+		{
+			// e1 when it is non zero, else e2
+			if(a.val != 0) { last = a; } else { run(e->e2); }
+			return;
+		}
+
+		folded b = run(e->e2);
+		set(a.e == e->e1 && b.e == e->e2 ? e : arn.make<or_else_expr>(a.e, b.e));
+	}
+};
+
+// Folds the expression argument, allocating new nodes from arn
+expr * fold(expr * e, arena & arn)
+{
+	folder f(arn);
+	return f.run(e).e;
+}
+
+#endif
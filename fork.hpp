@@ -0,0 +1,190 @@
+#ifndef FORK_HPP
+#define FORK_HPP
+
+# include <cstddef>
+# include <exception>
+
+# include "ast/expression.hpp"
+# include "com/work_pool.hpp"
+
+// *************************************************************************** //
+// Parallel evaluation
+//
+// Summary:
+//		- fork_evaluator::eval() computes an expression like eval(), with
+//			the operands of large nodes evaluated on a work stealing pool.
+//		- When both operands of a binary node have at least grain nodes,
+//			the second is spawned as a task while the first is evaluated
+//			here, and then the task is joined. A subtree smaller than grain
+//			is handed to eval(), so small work never pays for a task.
+//		- cond_expr, and_then_expr and or_else_expr evaluate their first
+//			operand before deciding which other operand runs, exactly as
+//			eval() does. Nothing is computed speculatively, so an operand
+//			that would divide by zero is never reached when eval() would
+//			not reach it.
+//		- Tasks must not throw, so a division error in a forked operand is
+//			kept with its task and rethrown once the task has been joined.
+//		- Shared nodes are not memoized. A shared subtree is evaluated
+//			once per use, so parsers that share subtrees keep eval().
+//
+// *************************************************************************** //
+class fork_evaluator
+{
+private:
+	// Evaluation of one operand on whichever worker takes it
+	class subtree : public work_pool::task
+	{
+	public:
+		fork_evaluator * f;
+		expr * e;
+		long long val;
+		std::exception_ptr error;
+
+		subtree(fork_evaluator * f, expr * e) : f(f), e(e), val(0) { }
+
+		void run()
+		{
+			try
+			{
+				val = f->node(e);
+			}
+			catch(...)
+			{
+				error = std::current_exception();
+			}
+		}
+	};
+
+	work_pool pool;
+	unsigned grain;
+
+	long long node(expr *);
+	void fork(expr *, expr *, long long &, long long &);
+
+	// Evaluates e1 into a and e2 into b, in parallel when both are large
+	// A long chain of small operands recurses through here, so the task
+	// and its error handling stay in fork()
+	void both(expr * e1, expr * e2, long long & a, long long & b)
+	{
+		if(e1->size < grain || e2->size < grain)
+		{
+			a = node(e1);
+			b = node(e2);
+			return;
+		}
+		fork(e1, e2, a, b);
+	}
+
+public:
+	// Uses threads workers and forks subtrees of at least grain nodes
+	fork_evaluator(std::size_t threads, unsigned grain = 16 * 1024) : pool(threads), grain(grain) { }
+
+	fork_evaluator(const fork_evaluator &) = delete;
+	fork_evaluator & operator=(const fork_evaluator &) = delete;
+
+	// Smallest subtree worth forking
+	unsigned cutoff() const { return grain; }
+
+	// Number of workers, counting the calling thread
+	std::size_t workers() const { return pool.size(); }
+
+	long long eval(expr * e)
+	{
+		if(e->size < grain || pool.size() == 1)
+		{
+			return ::eval(e);
+		}
+
+		// execute() must return normally to end the call
+		long long val = 0;
+		std::exception_ptr error;
+		pool.execute([&]
+		{
+			try
+			{
+				val = node(e);
+			}
+			catch(...)
+			{
+				error = std::current_exception();
+			}
+		});
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+		return val;
+	}
+};
+
+// Evaluates e2 as a task while e1 is evaluated here
+// t lives on this frame, so it is joined even when e1 throws
+void fork_evaluator::fork(expr * e1, expr * e2, long long & a, long long & b)
+{
+	subtree t(this, e2);
+	pool.spawn(& t);
+	try
+	{
+		a = node(e1);
+	}
+	catch(...)
+	{
+		pool.wait(& t);
+		throw;
+	}
+	pool.wait(& t);
+	if(t.error)
+	{
+		std::rethrow_exception(t.error);
+	}
+	b = t.val;
+}
+
+// Evaluates e, forking its large operands
+long long fork_evaluator::node(expr * e)
+{
+	if(e->size < grain)
+	{
+		return ::eval(e);
+	}
+
+	// Derived expression visitor class
+	// Same results as eval()'s visitor with both() computing the operands
+	class v : public expr::visitor
+	{
+	public:
+		fork_evaluator * f;
+		long long val;
+		long long a;
+		long long b;
+		v(fork_evaluator * f) : f(f), val(0), a(0), b(0) { }
+		void visit(bool_expr * e) { val = convert(e->val); }
+		void visit(int_expr * e) { val = e->val; }
+		void visit(ref_expr * e) { val = (* e->values)[e->slot]; }
+		void visit(and_expr * e) { f->both(e->e1, e->e2, a, b); val = convert(a & b); }
+		void visit(or_expr * e) { f->both(e->e1, e->e2, a, b); val = convert(a | b); }
+		void visit(xor_expr * e) { f->both(e->e1, e->e2, a, b); val = convert(a ^ b); }
+		void visit(not_expr * e) { val = convert(!f->node(e->e)); }
+		void visit(cond_expr * e) { val = (f->node(e->e1) ? f->node(e->e2) : f->node(e->e3)); }
+		void visit(equal_expr * e) { f->both(e->e1, e->e2, a, b); val = convert(a == b); }
+		void visit(not_equal_expr * e) { f->both(e->e1, e->e2, a, b); val = convert(a != b); }
+		void visit(less_than_expr * e) { f->both(e->e1, e->e2, a, b); val = convert(a < b); }
+		void visit(greater_than_expr * e) { f->both(e->e1, e->e2, a, b); val = convert(a > b); }
+		void visit(less_than_eq_expr * e) { f->both(e->e1, e->e2, a, b); val = convert(a <= b); }
+		void visit(greater_than_eq_expr * e) { f->both(e->e1, e->e2, a, b); val = convert(a >= b); }
+		void visit(add_expr * e) { f->both(e->e1, e->e2, a, b); val = a + b; }
+		void visit(sub_expr * e) { f->both(e->e1, e->e2, a, b); val = a - b; }
+		void visit(multi_expr * e) { f->both(e->e1, e->e2, a, b); val = a * b; }
+		void visit(div_expr * e) { f->both(e->e1, e->e2, a, b); val = int_div(a, b); }
+		void visit(rem_expr * e) { f->both(e->e1, e->e2, a, b); val = int_rem(a, b); }
+		void visit(neg_expr * e) { val = -f->node(e->e); }
+		void visit(and_then_expr * e) { val = f->node(e->e1) == 1 ? f->node(e->e2) : 0; }
+		void visit(or_else_expr * e) { val = f->node(e->e1); if(val == 0) { val = f->node(e->e2); } }
+	};
+
+	v vis(this);
+	e->accept(vis);
+	return vis.val;
+}
+
+#endif
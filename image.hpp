@@ -0,0 +1,451 @@
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+# include <cstddef>
+# include <cstdint>
+# include <cstring>
+# include <string_view>
+# include <unordered_map>
+# include <vector>
+
+# include "ast/expression.hpp"
+# include "ast/statement.hpp"
+# include "ast/declaration.hpp"
+# include "com/arena.hpp"
+# include "com/writer.hpp"
+
+// *************************************************************************** //
+// Binary syntax tree images
+//
+// Summary:
+//		- write_image() stores parsed statements as a pool of constants, a
+//			flat array of 16 byte nodes and an array of statements. A node
+//			names its sub expressions and its literal by their index, so an
+//			image holds no pointers and means the same wherever it is mapped.
+//		- Nodes are written after their sub expressions, and identical
+//			nodes and constants are written once, so every index points
+//			backwards and repeated subtrees cost nothing.
+//		- image reads a mapped file in place. The constructor checks the
+//			magic, version and sizes and that every index points backwards,
+//			so a damaged file is rejected before anything follows it.
+//		- image::evaluate() runs a statement straight from the mapping;
+//			image::load() rebuilds the statements as ordinary nodes in an
+//			arena for anything that needs them, such as the jit.
+//		- Integers are stored in the writer's byte order, which the version
+//			field also checks, since it reads back wrong on any other.
+//
+// *************************************************************************** //
+
+const std::uint32_t image_version = 1;
+
+// One per expression class, in the order of expr::visitor
+enum image_op : std::uint8_t
+{
+	im_bool,
+	im_int,
+	im_ref,
+	im_and,
+	im_or,
+	im_xor,
+	im_not,
+	im_cond,
+	im_equal,
+	im_not_equal,
+	im_less_than,
+	im_greater_than,
+	im_less_than_eq,
+	im_greater_than_eq,
+	im_add,
+	im_sub,
+	im_multi,
+	im_div,
+	im_rem,
+	im_neg,
+	im_and_then,
+	im_or_else,
+	im_count
+};
+
+struct image_header
+{
+	char magic[4];
+	std::uint32_t version;
+	std::uint32_t nodes;
+	std::uint32_t statements;
+	std::uint32_t slots;
+	std::uint32_t constants;
+};
+
+// e[0] is the constant of im_bool and im_int and the slot of im_ref
+struct image_node
+{
+	std::uint8_t op;
+	std::uint8_t is_bool;
+	std::uint16_t unused;
+	std::uint32_t e[3];
+
+	bool operator==(const image_node & n) const
+	{
+		return op == n.op && is_bool == n.is_bool && e[0] == n.e[0] && e[1] == n.e[1] && e[2] == n.e[2];
+	}
+};
+
+struct image_node_hash
+{
+	std::size_t operator()(const image_node & n) const
+	{
+		std::size_t h = n.op * 2 + n.is_bool;
+		h = h * 31 + n.e[0];
+		h = h * 31 + n.e[1];
+		return h * 31 + n.e[2];
+	}
+};
+
+// slot is -1 for expression statements
+struct image_stmt
+{
+	std::uint32_t node;
+	std::int32_t slot;
+};
+
+static_assert(sizeof(image_header) == 24 && sizeof(image_node) == 16 && sizeof(image_stmt) == 8,
+	"image records must have the same layout on every compiler");
+
+static const char image_magic[4] = { 'U', 'A', 'S', 'T' };
+
+// Writes statements as an image
+void write_image(const std::vector<stmt *> & statements, writer & out)
+{
+	// Derived expression visitor class
+	// Appends each node after its sub expressions and sets index to it
+	class expression_writer : public expr::visitor
+	{
+	public:
+		std::vector<long long> constants;
+		std::vector<image_node> nodes;
+		std::unordered_map<long long, std::uint32_t> pooled;
+		std::unordered_map<image_node, std::uint32_t, image_node_hash> unique;
+		std::unordered_map<expr *, std::uint32_t> written;
+		std::uint32_t index;
+		std::int32_t slots;
+
+		expression_writer() : index(0), slots(0) { }
+
+		std::uint32_t run(expr * e)
+		{
+			std::unordered_map<expr *, std::uint32_t>::iterator it = written.find(e);
+			if(it != written.end())
+			{
+				return it->second;
+			}
+			e->accept(* this);
+			written.emplace(e, index);
+			return index;
+		}
+
+		// Sets index to the node, adding it unless an identical one exists
+		void node(expr * e, image_op op, std::uint32_t e1 = 0, std::uint32_t e2 = 0, std::uint32_t e3 = 0)
+		{
+			image_node n = { op, e->t == & types().bool_type, 0, { e1, e2, e3 } };
+			std::unordered_map<image_node, std::uint32_t, image_node_hash>::iterator it = unique.find(n);
+			if(it != unique.end())
+			{
+				index = it->second;
+				return;
+			}
+			index = static_cast<std::uint32_t>(nodes.size());
+			nodes.push_back(n);
+			unique.emplace(n, index);
+		}
+
+		std::uint32_t constant(long long val)
+		{
+			std::unordered_map<long long, std::uint32_t>::iterator it = pooled.find(val);
+			if(it != pooled.end())
+			{
+				return it->second;
+			}
+			constants.push_back(val);
+			pooled.emplace(val, static_cast<std::uint32_t>(constants.size() - 1));
+			return static_cast<std::uint32_t>(constants.size() - 1);
+		}
+
+		void unary(expr * e, expr * e1, image_op op)
+		{
+			std::uint32_t a = run(e1);
+			node(e, op, a);
+		}
+
+		void binary(expr * e, expr * e1, expr * e2, image_op op)
+		{
+			std::uint32_t a = run(e1);
+			std::uint32_t b = run(e2);
+			node(e, op, a, b);
+		}
+
+		void visit(bool_expr * e) { node(e, im_bool, constant(convert(e->val))); }
+		void visit(int_expr * e) { node(e, im_int, constant(e->val)); }
+		void visit(ref_expr * e)
+		{
+			node(e, im_ref, e->slot);
+			slots = std::max(slots, e->slot + 1);
+		}
+		void visit(and_expr * e) { binary(e, e->e1, e->e2, im_and); }
+		void visit(or_expr * e) { binary(e, e->e1, e->e2, im_or); }
+		void visit(xor_expr * e) { binary(e, e->e1, e->e2, im_xor); }
+		void visit(not_expr * e) { unary(e, e->e, im_not); }
+		void visit(cond_expr * e)
+		{
+			std::uint32_t a = run(e->e1);
+			std::uint32_t b = run(e->e2);
+			std::uint32_t c = run(e->e3);
+			node(e, im_cond, a, b, c);
+		}
+		void visit(equal_expr * e) { binary(e, e->e1, e->e2, im_equal); }
+		void visit(not_equal_expr * e) { binary(e, e->e1, e->e2, im_not_equal); }
+		void visit(less_than_expr * e) { binary(e, e->e1, e->e2, im_less_than); }
+		void visit(greater_than_expr * e) { binary(e, e->e1, e->e2, im_greater_than); }
+		void visit(less_than_eq_expr * e) { binary(e, e->e1, e->e2, im_less_than_eq); }
+		void visit(greater_than_eq_expr * e) { binary(e, e->e1, e->e2, im_greater_than_eq); }
+		void visit(add_expr * e) { binary(e, e->e1, e->e2, im_add); }
+		void visit(sub_expr * e) { binary(e, e->e1, e->e2, im_sub); }
+		void visit(multi_expr * e) { binary(e, e->e1, e->e2, im_multi); }
+		void visit(div_expr * e) { binary(e, e->e1, e->e2, im_div); }
+		void visit(rem_expr * e) { binary(e, e->e1, e->e2, im_rem); }
+		void visit(neg_expr * e) { unary(e, e->e, im_neg); }
+		void visit(and_then_expr * e) { binary(e, e->e1, e->e2, im_and_then); }
+		void visit(or_else_expr * e) { binary(e, e->e1, e->e2, im_or_else); }
+	};
+
+	// Derived statement visitor class
+	class statement_writer : public stmt::visitor
+	{
+	public:
+		expression_writer nodes;
+		std::vector<image_stmt> statements;
+
+		void visit(expr_stmt * s) { statements.push_back({ nodes.run(s->e), -1 }); }
+		void visit(decl_stmt * s)
+		{
+			// var_decl is the only declaration
+			var_decl * v = static_cast<var_decl *>(s->d);
+			statements.push_back({ nodes.run(v->e), v->slot });
+			nodes.slots = std::max(nodes.slots, v->slot + 1);
+		}
+	};
+
+	statement_writer w;
+	for(stmt * s : statements)
+	{
+		s->accept(w);
+	}
+
+	image_header h = { { image_magic[0], image_magic[1], image_magic[2], image_magic[3] }, image_version,
+		static_cast<std::uint32_t>(w.nodes.nodes.size()), static_cast<std::uint32_t>(w.statements.size()),
+		static_cast<std::uint32_t>(w.nodes.slots), static_cast<std::uint32_t>(w.nodes.constants.size()) };
+	out.put(std::string_view(reinterpret_cast<const char *>(& h), sizeof(h)));
+	out.put(std::string_view(reinterpret_cast<const char *>(w.nodes.constants.data()), w.nodes.constants.size() * sizeof(long long)));
+	out.put(std::string_view(reinterpret_cast<const char *>(w.nodes.nodes.data()), w.nodes.nodes.size() * sizeof(image_node)));
+	out.put(std::string_view(reinterpret_cast<const char *>(w.statements.data()), w.statements.size() * sizeof(image_stmt)));
+}
+
+// *************************************************************************** //
+// Image class
+//
+// Summary:
+//		- A checked view of an image held in memory, usually a mapped_file.
+//			The bytes must stay valid and 8 byte aligned while it is used.
+//
+// *************************************************************************** //
+class image
+{
+private:
+	const image_header * header;
+	const long long * constants;
+	const image_node * nodes;
+	const image_stmt * stmts;
+
+	long long run(std::uint32_t, const long long *) const;
+
+public:
+	image(std::string_view);
+
+	std::size_t statements() const { return header->statements; }
+	std::size_t slots() const { return header->slots; }
+
+	long long evaluate(std::size_t, std::vector<long long> &) const;
+	std::vector<stmt *> load(arena &, std::vector<long long> *) const;
+};
+
+image::image(std::string_view bytes)
+{
+	if(bytes.size() < sizeof(image_header) || reinterpret_cast<std::size_t>(bytes.data()) % alignof(long long) != 0)
+	{
+		throw std::exception("Not an image");
+	}
+
+	header = reinterpret_cast<const image_header *>(bytes.data());
+	if(std::memcmp(header->magic, image_magic, sizeof(image_magic)) != 0)
+	{
+		throw std::exception("Not an image");
+	}
+	if(header->version != image_version)
+	{
+		throw std::exception("Unsupported image version");
+	}
+
+	std::size_t k = header->constants;
+	std::size_t n = header->nodes;
+	std::size_t s = header->statements;
+	if(bytes.size() != sizeof(image_header) + k * sizeof(long long) + n * sizeof(image_node) + s * sizeof(image_stmt))
+	{
+		throw std::exception("Truncated image");
+	}
+
+	constants = reinterpret_cast<const long long *>(bytes.data() + sizeof(image_header));
+	nodes = reinterpret_cast<const image_node *>(constants + k);
+	stmts = reinterpret_cast<const image_stmt *>(nodes + n);
+
+	// Sub expressions come first, so following any index always ends
+	for(std::size_t i = 0; i < n; ++i)
+	{
+		const image_node & e = nodes[i];
+		std::size_t children = e.op == im_cond ? 3 : e.op == im_not || e.op == im_neg ? 1 : e.op <= im_ref ? 0 : 2;
+		if(e.op >= im_count || (e.op == im_ref && e.e[0] >= header->slots) || (e.op <= im_int && e.e[0] >= k))
+		{
+			throw std::exception("Corrupt image node");
+		}
+		for(std::size_t c = 0; c < children; ++c)
+		{
+			if(e.e[c] >= i)
+			{
+				throw std::exception("Corrupt image node");
+			}
+		}
+	}
+
+	for(std::size_t i = 0; i < s; ++i)
+	{
+		if(stmts[i].node >= n || stmts[i].slot < -1 || stmts[i].slot >= static_cast<std::int32_t>(header->slots))
+		{
+			throw std::exception("Corrupt image statement");
+		}
+	}
+}
+
+// Evaluates node i like eval() evaluates the expression it was written from
+long long image::run(std::uint32_t i, const long long * values) const
+{
+	const image_node & n = nodes[i];
+	switch(n.op)
+	{
+		case im_bool:
+		case im_int: return constants[n.e[0]];
+		case im_ref: return values[n.e[0]];
+		case im_and: return convert(run(n.e[0], values) & run(n.e[1], values));
+		case im_or: return convert(run(n.e[0], values) | run(n.e[1], values));
+		case im_xor: return convert(run(n.e[0], values) ^ run(n.e[1], values));
+		case im_not: return convert(!run(n.e[0], values));
+		case im_cond: return run(n.e[0], values) ? run(n.e[1], values) : run(n.e[2], values);
+		case im_equal: return convert(run(n.e[0], values) == run(n.e[1], values));
+		case im_not_equal: return convert(run(n.e[0], values) != run(n.e[1], values));
+		case im_less_than: return convert(run(n.e[0], values) < run(n.e[1], values));
+		case im_greater_than: return convert(run(n.e[0], values) > run(n.e[1], values));
+		case im_less_than_eq: return convert(run(n.e[0], values) <= run(n.e[1], values));
+		case im_greater_than_eq: return convert(run(n.e[0], values) >= run(n.e[1], values));
+		case im_add: return run(n.e[0], values) + run(n.e[1], values);
+		case im_sub: return run(n.e[0], values) - run(n.e[1], values);
+		case im_multi: return run(n.e[0], values) * run(n.e[1], values);
+		case im_div:
+		{
+			long long a = run(n.e[0], values);
+			return int_div(a, run(n.e[1], values));
+		}
+		case im_rem:
+		{
+			long long a = run(n.e[0], values);
+			return int_rem(a, run(n.e[1], values));
+		}
+		case im_neg: return -run(n.e[0], values);
+		case im_and_then: return run(n.e[0], values) == 1 ? run(n.e[1], values) : 0;
+		case im_or_else:
+		{
+			long long val = run(n.e[0], values);
+			return val != 0 ? val : run(n.e[1], values);
+		}
+	}
+	return 0;
+}
+
+// Evaluates statement i in place, declarations store into values
+long long image::evaluate(std::size_t i, std::vector<long long> & values) const
+{
+	if(values.size() < header->slots)
+	{
+		values.resize(header->slots);
+	}
+
+	long long val = run(stmts[i].node, values.data());
+	if(stmts[i].slot >= 0)
+	{
+		values[stmts[i].slot] = val;
+	}
+	return val;
+}
+
+// Rebuilds the statements in arn with variables read from values
+// The nodes check their types as they are made, as when parsing
+std::vector<stmt *> image::load(arena & arn, std::vector<long long> * values) const
+{
+	std::vector<expr *> built(header->nodes);
+	for(std::size_t i = 0; i < built.size(); ++i)
+	{
+		// Only the operators with sub expressions index built, e[0] of a
+		// leaf is a constant or a slot
+		const image_node & n = nodes[i];
+		type * t = n.is_bool ? static_cast<type *>(& types().bool_type) : & types().int_type;
+		switch(n.op)
+		{
+			case im_bool: built[i] = arn.make<bool_expr>(constants[n.e[0]] != 0); break;
+			case im_int: built[i] = arn.make<int_expr>(constants[n.e[0]]); break;
+			case im_ref: built[i] = arn.make<ref_expr>(t, static_cast<int>(n.e[0]), values); break;
+			case im_and: built[i] = arn.make<and_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_or: built[i] = arn.make<or_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_xor: built[i] = arn.make<xor_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_not: built[i] = arn.make<not_expr>(built[n.e[0]]); break;
+			case im_cond: built[i] = arn.make<cond_expr>(built[n.e[0]], built[n.e[1]], built[n.e[2]]); break;
+			case im_equal: built[i] = arn.make<equal_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_not_equal: built[i] = arn.make<not_equal_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_less_than: built[i] = arn.make<less_than_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_greater_than: built[i] = arn.make<greater_than_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_less_than_eq: built[i] = arn.make<less_than_eq_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_greater_than_eq: built[i] = arn.make<greater_than_eq_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_add: built[i] = arn.make<add_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_sub: built[i] = arn.make<sub_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_multi: built[i] = arn.make<multi_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_div: built[i] = arn.make<div_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_rem: built[i] = arn.make<rem_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_neg: built[i] = arn.make<neg_expr>(built[n.e[0]]); break;
+			case im_and_then: built[i] = arn.make<and_then_expr>(built[n.e[0]], built[n.e[1]]); break;
+			case im_or_else: built[i] = arn.make<or_else_expr>(built[n.e[0]], built[n.e[1]]); break;
+		}
+	}
+
+	std::vector<stmt *> statements;
+	statements.reserve(header->statements);
+	for(std::size_t i = 0; i < header->statements; ++i)
+	{
+		expr * e = built[stmts[i].node];
+		if(stmts[i].slot < 0)
+		{
+			statements.push_back(arn.make<expr_stmt>(e));
+		}
+		else
+		{
+			statements.push_back(arn.make<decl_stmt>(arn.make<var_decl>(e->t, e, stmts[i].slot, values)));
+		}
+	}
+	return statements;
+}
+
+#endif
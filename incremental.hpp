@@ -0,0 +1,411 @@
+#ifndef INCREMENTAL_HPP
+#define INCREMENTAL_HPP
+
+# include <cstddef>
+# include <exception>
+# include <memory>
+# include <string>
+# include <string_view>
+# include <utility>
+# include <vector>
+
+# include "lexer.hpp"
+# include "parser.hpp"
+# include "ast/symbol.hpp"
+# include "ast/token.hpp"
+# include "com/interner.hpp"
+# include "com/writer.hpp"
+
+// *************************************************************************** //
+// Incremental parser class
+//
+// Summary:
+//		- Holds a program being edited along with its tokens and syntax
+//			trees, so an edit relexes and reparses the lines it touched
+//			instead of the whole text.
+//		- Lines are the unit of reuse. No token crosses a newline and a
+//			newline ends a statement, so every line lexes and parses on its
+//			own given the declarations before it.
+//		- A line records the bindings its declarations changed. To parse an
+//			edited line the bindings of it and every line after it are
+//			undone, then those of the later lines are redone. A later line
+//			is parsed again, from its tokens, only if it names a variable
+//			whose binding the edit changed; its own bindings then count as
+//			changed too.
+//		- declares holds how many bindings each line made, so the lines
+//			that declare nothing are skipped without being touched, and uses
+//			how many tokens name each variable, so when no other line names
+//			a variable whose binding changed the later lines are not read.
+//		- A line that fails to lex or parse keeps its error along with the
+//			statements before it, as parse() would. evaluate() stops at the
+//			first such line, after writing the results of the lines before
+//			it and of those statements.
+//		- Replaced statements stay in the parser's arena. Once they
+//			outnumber the live ones every line is parsed again into a fresh
+//			arena, from the tokens already lexed.
+//
+// *************************************************************************** //
+class incremental_parser
+{
+private:
+	struct line
+	{
+		std::string text;
+		std::vector<token> tokens;
+		std::vector<stmt *> statements;
+		std::vector<binding> bindings;
+		std::exception_ptr lex_error;
+		std::exception_ptr error;
+	};
+
+	interner names;
+	lexer lxr;
+	parser prsr;
+	std::vector<std::unique_ptr<line>> lines;
+	std::vector<unsigned> declares;
+	std::vector<unsigned> uses;
+	std::size_t live;
+	std::size_t dead;
+	std::size_t lexed;
+	std::size_t parsed;
+
+	void lex(line &);
+	void parse(line &);
+	void rebuild();
+	std::unique_ptr<line> make_line(std::string_view);
+	void tally(const line &, int);
+
+	static void mark(std::vector<bool> &, unsigned);
+	static bool mentions(const line &, const std::vector<bool> &);
+
+public:
+	incremental_parser() : lxr(& names), live(0), dead(0), lexed(0), parsed(0) { }
+
+	incremental_parser(const incremental_parser &) = delete;
+	incremental_parser & operator=(const incremental_parser &) = delete;
+
+	// The parser the lines are parsed with, to set its options
+	parser & syntax() { return prsr; }
+
+	void load(std::string_view);
+	void edit(std::size_t, std::size_t, std::size_t, std::string_view);
+	void evaluate(writer &);
+
+	std::string text() const;
+
+	// Number of lines
+	std::size_t size() const { return lines.size(); }
+
+	// Lines lexed and parsed since construction
+	std::size_t relexed() const { return lexed; }
+	std::size_t reparsed() const { return parsed; }
+};
+
+void incremental_parser::lex(line & l)
+{
+	l.lex_error = nullptr;
+	try
+	{
+		lxr.lex(l.text, l.tokens);
+	}
+	catch(...)
+	{
+		parser::trim(l.tokens);
+		l.lex_error = std::current_exception();
+	}
+	++lexed;
+}
+
+// Parses l after the lines before it, dropping what it parsed to before
+// A parse error comes before the line's lexer error, if any
+void incremental_parser::parse(line & l)
+{
+	live -= l.statements.size();
+	dead += l.statements.size();
+	l.statements.clear();
+	l.bindings.clear();
+	l.error = l.lex_error;
+
+	try
+	{
+		l.statements = prsr.parse_line(l.tokens, & l.bindings);
+	}
+	catch(...)
+	{
+		l.statements = prsr.parsed();
+		l.error = std::current_exception();
+	}
+	live += l.statements.size();
+	++parsed;
+}
+
+// Parses every line again into a fresh arena
+void incremental_parser::rebuild()
+{
+	prsr.reset();
+	for(std::unique_ptr<line> & l : lines)
+	{
+		l->statements.clear();
+		l->bindings.clear();
+	}
+	live = 0;
+	for(std::size_t i = 0; i < lines.size(); ++i)
+	{
+		parse(*lines[i]);
+		declares[i] = static_cast<unsigned>(lines[i]->bindings.size());
+	}
+	dead = 0;
+}
+
+std::unique_ptr<incremental_parser::line> incremental_parser::make_line(std::string_view text)
+{
+	std::unique_ptr<line> l(new line());
+	l->text = text;
+	lex(*l);
+	tally(*l, 1);
+	return l;
+}
+
+// Adds delta to the uses of every name l mentions
+void incremental_parser::tally(const line & l, int delta)
+{
+	for(const token & t : l.tokens)
+	{
+		if(t.kind == identifier)
+		{
+			std::size_t name = static_cast<std::size_t>(t.val);
+			if(name >= uses.size())
+			{
+				uses.resize(name + 1, 0);
+			}
+			uses[name] += delta;
+		}
+	}
+}
+
+void incremental_parser::mark(std::vector<bool> & set, unsigned name)
+{
+	if(name >= set.size())
+	{
+		set.resize(name + 1, false);
+	}
+	set[name] = true;
+}
+
+// True if an identifier of l is in set
+bool incremental_parser::mentions(const line & l, const std::vector<bool> & set)
+{
+	for(const token & t : l.tokens)
+	{
+		if(t.kind == identifier && static_cast<std::size_t>(t.val) < set.size() && set[static_cast<std::size_t>(t.val)])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Replaces the program with text
+void incremental_parser::load(std::string_view text)
+{
+	lines.clear();
+	uses.clear();
+	while(true)
+	{
+		std::size_t n = text.find('\n');
+		lines.push_back(make_line(text.substr(0, n)));
+		if(n == std::string_view::npos)
+		{
+			break;
+		}
+		text.remove_prefix(n + 1);
+	}
+	declares.assign(lines.size(), 0);
+	rebuild();
+}
+
+// Replaces erase characters at column of row with text, either of which may
+// span lines, and parses the program again from there
+void incremental_parser::edit(std::size_t row, std::size_t column, std::size_t erase, std::string_view text)
+{
+	if(row >= lines.size() || column > lines[row]->text.size())
+	{
+		throw std::exception("Edit outside the program");
+	}
+
+	// Join the lines the erased characters run into
+	std::size_t end = row + 1;
+	std::string damaged = lines[row]->text;
+	while(damaged.size() - column < erase && end < lines.size())
+	{
+		damaged += '\n';
+		damaged += lines[end++]->text;
+	}
+	if(damaged.size() - column < erase)
+	{
+		throw std::exception("Edit outside the program");
+	}
+	damaged.replace(column, erase, text);
+
+	// Go back to the bindings before the damaged lines
+	for(std::size_t i = lines.size(); i-- > row; )
+	{
+		if(declares[i] != 0)
+		{
+			for(std::size_t j = declares[i]; j-- > 0; )
+			{
+				prsr.unbind(lines[i]->bindings[j]);
+			}
+		}
+	}
+
+	// What the damaged lines left each name they declared bound to
+	std::vector<std::pair<unsigned, symbol>> expected;
+	for(std::size_t i = row; i < end; ++i)
+	{
+		for(const binding & b : lines[i]->bindings)
+		{
+			expected.emplace_back(b.name, b.after);
+		}
+		live -= lines[i]->statements.size();
+		dead += lines[i]->statements.size();
+		tally(*lines[i], -1);
+	}
+
+	std::vector<std::unique_ptr<line>> edited;
+	std::vector<std::pair<unsigned, symbol>> before;
+	std::string_view rest = damaged;
+	while(true)
+	{
+		std::size_t n = rest.find('\n');
+		edited.push_back(make_line(rest.substr(0, n)));
+		parse(*edited.back());
+		for(const binding & b : edited.back()->bindings)
+		{
+			before.emplace_back(b.name, b.before);
+		}
+
+		if(n == std::string_view::npos)
+		{
+			break;
+		}
+		rest.remove_prefix(n + 1);
+	}
+
+	// A name only the new lines declare must be bound to what it was
+	// before them. The last binding expected of a name is checked, which
+	// is the one the old lines left it with if they declared it, and
+	// otherwise the first one the new lines changed
+	expected.insert(expected.begin(), before.rbegin(), before.rend());
+	std::vector<bool> checked;
+	std::vector<bool> changed;
+	bool named = false;
+	for(const std::unique_ptr<line> & l : edited)
+	{
+		tally(*l, -1);
+	}
+	for(std::size_t i = expected.size(); i-- > 0; )
+	{
+		unsigned name = expected[i].first;
+		if(name < checked.size() && checked[name])
+		{
+			continue;
+		}
+		mark(checked, name);
+
+		symbol now = prsr.bound(name);
+		if(now.t != expected[i].second.t || now.slot != expected[i].second.slot)
+		{
+			mark(changed, name);
+			named = named || (name < uses.size() && uses[name] != 0);
+		}
+	}
+	for(const std::unique_ptr<line> & l : edited)
+	{
+		tally(*l, 1);
+	}
+
+	// Most edits stay inside one line, which is replaced where it is
+	std::size_t count = edited.size();
+	if(count == end - row)
+	{
+		std::move(edited.begin(), edited.end(), lines.begin() + row);
+	}
+	else
+	{
+		lines.erase(lines.begin() + row, lines.begin() + end);
+		lines.insert(lines.begin() + row, std::make_move_iterator(edited.begin()), std::make_move_iterator(edited.end()));
+		declares.erase(declares.begin() + row, declares.begin() + end);
+		declares.insert(declares.begin() + row, count, 0);
+	}
+	for(std::size_t i = row; i < row + count; ++i)
+	{
+		declares[i] = static_cast<unsigned>(lines[i]->bindings.size());
+	}
+
+	for(std::size_t i = row + count; i < lines.size(); ++i)
+	{
+		if(named && mentions(*lines[i], changed))
+		{
+			// Whatever the line declares may now be bound differently
+			for(const binding & b : lines[i]->bindings)
+			{
+				mark(changed, b.name);
+			}
+			parse(*lines[i]);
+			for(const binding & b : lines[i]->bindings)
+			{
+				mark(changed, b.name);
+			}
+			declares[i] = static_cast<unsigned>(lines[i]->bindings.size());
+		}
+		else if(declares[i] != 0)
+		{
+			for(const binding & b : lines[i]->bindings)
+			{
+				prsr.rebind(b);
+			}
+		}
+	}
+
+	if(dead > live + 64 * 1024)
+	{
+		rebuild();
+	}
+}
+
+// Writes the value of every statement, then rethrows the first error
+void incremental_parser::evaluate(writer & out)
+{
+	for(std::unique_ptr<line> & l : lines)
+	{
+		for(stmt * st : l->statements)
+		{
+			out.put_int(st->evaluate());
+			out.put('\n');
+		}
+		if(l->error)
+		{
+			out.flush();
+			std::rethrow_exception(l->error);
+		}
+	}
+	out.flush();
+}
+
+// The program as edited
+std::string incremental_parser::text() const
+{
+	std::string s;
+	for(std::size_t i = 0; i < lines.size(); ++i)
+	{
+		if(i > 0)
+		{
+			s += '\n';
+		}
+		s += lines[i]->text;
+	}
+	return s;
+}
+
+#endif
@@ -0,0 +1,401 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+# include <climits>
+# include <cstddef>
+# include <cstring>
+# include <initializer_list>
+# include <unordered_map>
+# include <vector>
+
+# include "ast/expression.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define UA_JIT 1
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#else
+#define UA_JIT 0
+#endif
+
+// *************************************************************************** //
+// Native code compilation
+//
+// Summary:
+//		- jit::compile() lowers an expression tree to x86-64 machine code
+//			and returns it as a function that stores the value of the
+//			expression in its first argument and returns 1. The second
+//			argument is the value array that ref_expr slots are read from.
+//		- The code keeps the current value in rax. A binary expression
+//			pushes the value of its first operand while the second is
+//			computed into rcx. cond_expr, and_then_expr and or_else_expr
+//			compile to branches so only the selected operand runs.
+//		- Division and remainder by zero, and LLONG_MIN / -1, make the
+//			function return 0 without a value. The caller falls back to
+//			the interpreter, which then throws as it always does.
+//		- Code is written into read write pages that are made read execute
+//			before use. drop() releases the code of one function, clear()
+//			or the destructor that of all of them.
+//		- compile() returns nullptr on other architectures and for
+//			expressions whose code exceeds the size limit, in which case
+//			the caller keeps interpreting.
+//		- threshold() is the number of evaluations after which the parser
+//			compiles the statements of a line its line cache answers.
+//
+// *************************************************************************** //
+typedef int (* native_fn)(long long *, const long long *);
+
+class jit
+{
+private:
+	// Size of the code at each address
+	std::unordered_map<void *, std::size_t> blocks;
+	const std::vector<long long> * values;
+	unsigned hot;
+	std::size_t limit;
+
+	static void * allocate(std::size_t);
+	static bool protect(void *, std::size_t);
+	static void release(void *, std::size_t);
+
+public:
+	static const bool supported = UA_JIT;
+
+	jit(unsigned hot = 1000, std::size_t limit = 1 << 20) : values(nullptr), hot(hot), limit(limit) { }
+	~jit() { clear(); }
+
+	jit(const jit &) = delete;
+	jit & operator=(const jit &) = delete;
+
+	native_fn compile(expr *);
+	void drop(native_fn);
+	void clear();
+
+	unsigned threshold() const { return hot; }
+
+	// Value array passed to the functions compiled by this jit
+	void bind(const std::vector<long long> * v) { values = v; }
+	const long long * frame() const { return values ? values->data() : nullptr; }
+	void set_threshold(unsigned n) { hot = n; }
+
+	// Number of compiled functions not yet released
+	std::size_t functions() const { return blocks.size(); }
+};
+
+#if UA_JIT
+
+#ifdef _WIN32
+
+void * jit::allocate(std::size_t size)
+{
+	return VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+bool jit::protect(void * data, std::size_t size)
+{
+	DWORD old;
+	if(!VirtualProtect(data, size, PAGE_EXECUTE_READ, & old))
+	{
+		return false;
+	}
+	return FlushInstructionCache(GetCurrentProcess(), data, size) != 0;
+}
+
+void jit::release(void * data, std::size_t size)
+{
+	VirtualFree(data, 0, MEM_RELEASE);
+}
+
+#else
+
+void * jit::allocate(std::size_t size)
+{
+	void * data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return data == MAP_FAILED ? nullptr : data;
+}
+
+bool jit::protect(void * data, std::size_t size)
+{
+	return mprotect(data, size, PROT_READ | PROT_EXEC) == 0;
+}
+
+void jit::release(void * data, std::size_t size)
+{
+	munmap(data, size);
+}
+
+#endif
+
+native_fn jit::compile(expr * e)
+{
+	// Derived expression visitor class
+	// Emits the code of each expression, leaving its value in rax
+	class emitter : public expr::visitor
+	{
+	public:
+		std::vector<unsigned char> code;
+		std::vector<std::size_t> bails;
+		std::size_t limit;
+
+		emitter(std::size_t limit) : limit(limit) { }
+
+		void bytes(std::initializer_list<unsigned char> b) { code.insert(code.end(), b); }
+
+		void imm(const void * p, std::size_t n)
+		{
+			const unsigned char * b = static_cast<const unsigned char *>(p);
+			code.insert(code.end(), b, b + n);
+		}
+
+		// Emits a jump with an empty rel32 and returns where to patch it
+		std::size_t jump(std::initializer_list<unsigned char> op)
+		{
+			bytes(op);
+			bytes({ 0, 0, 0, 0 });
+			return code.size() - 4;
+		}
+
+		// Points the jump at index to the next instruction
+		void patch(std::size_t index)
+		{
+			int rel = static_cast<int>(code.size() - (index + 4));
+			std::memcpy(& code[index], & rel, 4);
+		}
+
+		// Stops walking the tree once the code is too large
+		void run(expr * e)
+		{
+			if(code.size() <= limit)
+			{
+				e->accept(* this);
+			}
+		}
+
+		// mov rax, val
+		void load(long long val)
+		{
+			if(val >= INT_MIN && val <= INT_MAX)
+			{
+				int v = static_cast<int>(val);
+				bytes({ 0x48, 0xC7, 0xC0 });
+				imm(& v, 4);
+			}
+			else
+			{
+				bytes({ 0x48, 0xB8 });
+				imm(& val, 8);
+			}
+		}
+
+		// Leaves e1 in rax and e2 in rcx
+		void operands(expr * e1, expr * e2)
+		{
+			run(e1);
+			bytes({ 0x50 });				// push rax
+			run(e2);
+			bytes({ 0x48, 0x89, 0xC1 });	// mov rcx, rax
+			bytes({ 0x58 });				// pop rax
+		}
+
+		// rax = rax != 0
+		void to_bool()
+		{
+			bytes({ 0x48, 0x85, 0xC0 });	// test rax, rax
+			bytes({ 0x0F, 0x95, 0xC0 });	// setne al
+			bytes({ 0x0F, 0xB6, 0xC0 });	// movzx eax, al
+		}
+
+		// and, or, xor of two bools
+		void logical(expr * e1, expr * e2, unsigned char op)
+		{
+			operands(e1, e2);
+			bytes({ 0x48, op, 0xC8 });		// op rax, rcx
+			to_bool();
+		}
+
+		void arithmetic(expr * e1, expr * e2, std::initializer_list<unsigned char> op)
+		{
+			operands(e1, e2);
+			bytes(op);
+		}
+
+		// rax = rax cc rcx
+		void compare(expr * e1, expr * e2, unsigned char cc)
+		{
+			operands(e1, e2);
+			bytes({ 0x48, 0x39, 0xC8 });	// cmp rax, rcx
+			bytes({ 0x0F, cc, 0xC0 });		// setcc al
+			bytes({ 0x0F, 0xB6, 0xC0 });	// movzx eax, al
+		}
+
+		// Bails out where idiv would trap
+		void division(expr * e1, expr * e2, bool remainder)
+		{
+			long long min = LLONG_MIN;
+			operands(e1, e2);
+			bytes({ 0x48, 0x85, 0xC9 });	// test rcx, rcx
+			bails.push_back(jump({ 0x0F, 0x84 }));	// jz bail
+			bytes({ 0x48, 0x83, 0xF9, 0xFF });	// cmp rcx, -1
+			bytes({ 0x75, 0x13 });			// jne over the next 19 bytes
+			bytes({ 0x48, 0xBA });			// mov rdx, LLONG_MIN
+			imm(& min, 8);
+			bytes({ 0x48, 0x39, 0xD0 });	// cmp rax, rdx
+			bails.push_back(jump({ 0x0F, 0x84 }));	// je bail
+			bytes({ 0x48, 0x99 });			// cqo
+			bytes({ 0x48, 0xF7, 0xF9 });	// idiv rcx
+			if(remainder)
+			{
+				bytes({ 0x48, 0x89, 0xD0 });	// mov rax, rdx
+			}
+		}
+
+		void visit(bool_expr * e) { load(convert(e->val)); }
+		void visit(int_expr * e) { load(e->val); }
+		void visit(ref_expr * e)
+		{
+			int offset = e->slot * 8;
+			bytes({ 0x49, 0x8B, 0x82 });	// mov rax, [r10 + offset]
+			imm(& offset, 4);
+		}
+		void visit(and_expr * e) { logical(e->e1, e->e2, 0x21); }
+		void visit(or_expr * e) { logical(e->e1, e->e2, 0x09); }
+		void visit(xor_expr * e) { logical(e->e1, e->e2, 0x31); }
+		void visit(not_expr * e)
+		{
+			run(e->e);
+			bytes({ 0x48, 0x85, 0xC0 });	// test rax, rax
+			bytes({ 0x0F, 0x94, 0xC0 });	// sete al
+			bytes({ 0x0F, 0xB6, 0xC0 });	// movzx eax, al
+		}
+		void visit(cond_expr * e)
+		{
+			run(e->e1);
+			bytes({ 0x48, 0x85, 0xC0 });	// test rax, rax
+			std::size_t to_else = jump({ 0x0F, 0x84 });	// jz else
+			run(e->e2);
+			std::size_t to_end = jump({ 0xE9 });	// jmp end
+			patch(to_else);
+			run(e->e3);
+			patch(to_end);
+		}
+		void visit(equal_expr * e) { compare(e->e1, e->e2, 0x94); }
+		void visit(not_equal_expr * e) { compare(e->e1, e->e2, 0x95); }
+		void visit(less_than_expr * e) { compare(e->e1, e->e2, 0x9C); }
+		void visit(greater_than_expr * e) { compare(e->e1, e->e2, 0x9F); }
+		void visit(less_than_eq_expr * e) { compare(e->e1, e->e2, 0x9E); }
+		void visit(greater_than_eq_expr * e) { compare(e->e1, e->e2, 0x9D); }
+		void visit(add_expr * e) { arithmetic(e->e1, e->e2, { 0x48, 0x01, 0xC8 }); }
+		void visit(sub_expr * e) { arithmetic(e->e1, e->e2, { 0x48, 0x29, 0xC8 }); }
+		void visit(multi_expr * e) { arithmetic(e->e1, e->e2, { 0x48, 0x0F, 0xAF, 0xC1 }); }
+		void visit(div_expr * e) { division(e->e1, e->e2, false); }
+		void visit(rem_expr * e) { division(e->e1, e->e2, true); }
+		void visit(neg_expr * e)
+		{
+			run(e->e);
+			bytes({ 0x48, 0xF7, 0xD8 });	// neg rax
+		}
+		void visit(and_then_expr * e)
+		{
+			// e1 == 1 ? e2 : false
+			run(e->e1);
+			bytes({ 0x48, 0x83, 0xF8, 0x01 });	// cmp rax, 1
+			std::size_t to_false = jump({ 0x0F, 0x85 });	// jne false
+			run(e->e2);
+			std::size_t to_end = jump({ 0xE9 });	// jmp end
+			patch(to_false);
+			bytes({ 0x31, 0xC0 });			// xor eax, eax
+			patch(to_end);
+		}
+		void visit(or_else_expr * e)
+		{
+			// e1 when it is non zero, else e2
+			run(e->e1);
+			bytes({ 0x48, 0x85, 0xC0 });	// test rax, rax
+			std::size_t to_end = jump({ 0x0F, 0x85 });	// jnz end
+			run(e->e2);
+			patch(to_end);
+		}
+	};
+
+	emitter em(limit);
+
+	// Keep the stack pointer for bailing out, and the arguments in r8, r10
+	em.bytes({ 0x49, 0x89, 0xE1 });		// mov r9, rsp
+#ifdef _WIN32
+	em.bytes({ 0x49, 0x89, 0xC8 });		// mov r8, rcx
+	em.bytes({ 0x49, 0x89, 0xD2 });		// mov r10, rdx
+#else
+	em.bytes({ 0x49, 0x89, 0xF8 });		// mov r8, rdi
+	em.bytes({ 0x49, 0x89, 0xF2 });		// mov r10, rsi
+#endif
+
+	em.run(e);
+	if(em.code.size() > limit)
+	{
+		return nullptr;
+	}
+
+	em.bytes({ 0x49, 0x89, 0x00 });		// mov [r8], rax
+	em.bytes({ 0xB8, 0x01, 0x00, 0x00, 0x00 });	// mov eax, 1
+	em.bytes({ 0xC3 });					// ret
+
+	for(std::size_t index : em.bails)
+	{
+		em.patch(index);
+	}
+	em.bytes({ 0x4C, 0x89, 0xCC });		// mov rsp, r9
+	em.bytes({ 0x31, 0xC0 });			// xor eax, eax
+	em.bytes({ 0xC3 });					// ret
+
+	std::size_t size = em.code.size();
+	void * data = allocate(size);
+	if(data == nullptr)
+	{
+		return nullptr;
+	}
+
+	std::memcpy(data, em.code.data(), size);
+	if(!protect(data, size))
+	{
+		release(data, size);
+		return nullptr;
+	}
+
+	blocks.emplace(data, size);
+	return reinterpret_cast<native_fn>(data);
+}
+
+#else
+
+void * jit::allocate(std::size_t) { return nullptr; }
+bool jit::protect(void *, std::size_t) { return false; }
+void jit::release(void *, std::size_t) { }
+
+native_fn jit::compile(expr *) { return nullptr; }
+
+#endif
+
+// Releases the code of f, which this jit compiled
+void jit::drop(native_fn f)
+{
+	std::unordered_map<void *, std::size_t>::iterator it = blocks.find(reinterpret_cast<void *>(f));
+	if(it != blocks.end())
+	{
+		release(it->first, it->second);
+		blocks.erase(it);
+	}
+}
+
+void jit::clear()
+{
+	for(std::pair<void * const, std::size_t> & b : blocks)
+	{
+		release(b.first, b.second);
+	}
+	blocks.clear();
+}
+
+#endif
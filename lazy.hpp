@@ -0,0 +1,282 @@
+#ifndef LAZY_HPP
+#define LAZY_HPP
+
+# include <cstddef>
+# include <unordered_map>
+# include <vector>
+
+# include "ast/expression.hpp"
+# include "com/arena.hpp"
+
+// *************************************************************************** //
+// Thunk table class
+//
+// Summary:
+//		- Holds what the parser deferred in lazy mode: a thunk for every
+//			declaration and every expression statement, numbered in the
+//			order they were parsed. A declaration's number is also its
+//			slot, so each declaration has a slot of its own and a reference
+//			names exactly the declaration it reads, even when the variable
+//			is declared again later.
+//		- The parser reports each reference it binds with refer(). add()
+//			makes the references since the last thunk the dependencies of
+//			the new one, so a thunk knows which declarations its expression
+//			reads without walking it again.
+//		- force() evaluates a thunk once, after the declarations it
+//			depends on, and caches its value in the slot. Dependencies are
+//			always earlier thunks, so there are no cycles, and they are
+//			forced from an explicit stack, so a long chain of declarations
+//			cannot overflow the call stack.
+//		- A thunk depends on every declaration its expression names, both
+//			arms of a conditional included. Only thunks that are forced and
+//			what they read are ever evaluated; the rest never are.
+//		- Once a name is declared again nothing new can read its earlier
+//			declaration. compact() keeps the thunks the parser still has
+//			names bound to and what the unforced ones among them depend on,
+//			numbered again in the same order. Their expressions are copied
+//			into a new arena, so the parser can free the syntax trees of
+//			everything else; a forced thunk keeps only its value.
+//
+// *************************************************************************** //
+class thunk_table
+{
+private:
+	struct thunk
+	{
+		expr * e;
+		std::size_t first;
+		std::size_t count;
+		bool forced;
+	};
+
+	std::vector<thunk> thunks;
+	std::vector<int> deps;
+	std::vector<int> pending;
+	std::vector<int> stack;
+	std::vector<long long> * values;
+	std::size_t made_count;
+	std::size_t forced_count;
+	std::size_t kept;
+
+public:
+	thunk_table(std::vector<long long> * values) : values(values), made_count(0), forced_count(0), kept(0) { }
+
+	thunk_table(const thunk_table &) = delete;
+	thunk_table & operator=(const thunk_table &) = delete;
+
+	// Records a reference to the declaration with number slot
+	void refer(int slot) { pending.push_back(slot); }
+
+	int add(expr *);
+	long long force(int);
+
+	// True once the thunks made since the last compact() outnumber the ones
+	// it kept, so compacting costs no more than making them did
+	bool due() const { return thunks.size() > 2 * kept + 64 * 1024; }
+	void compact(std::vector<int> &, arena &);
+
+	// Thunks made and forced since construction
+	std::size_t size() const { return made_count; }
+	std::size_t forced() const { return forced_count; }
+};
+
+// *************************************************************************** //
+// Thunk copier class
+//
+// Summary:
+//		- Copies the expression of a thunk compact() keeps into a new arena,
+//			renumbering each reference to the declaration it reads.
+//		- A node reached twice, as the parser shares them, is copied once
+//			so the copy stays the same size as the original.
+//
+// *************************************************************************** //
+class thunk_copier : public expr::visitor
+{
+public:
+	arena & to;
+	const std::vector<int> & number;
+	std::unordered_map<expr *, expr *> copies;
+	expr * last;
+
+	thunk_copier(arena & to, const std::vector<int> & number) : to(to), number(number), last(nullptr) { }
+
+	expr * run(expr * e)
+	{
+		auto it = copies.find(e);
+		if(it != copies.end())
+		{
+			return it->second;
+		}
+
+		e->accept(* this);
+		copies.emplace(e, last);
+		return last;
+	}
+
+	template<typename T>
+	void unary(T * e)
+	{
+		expr * a = run(e->e);
+		last = to.make<T>(a);
+	}
+
+	template<typename T>
+	void binary(T * e)
+	{
+		expr * a = run(e->e1);
+		expr * b = run(e->e2);
+		last = to.make<T>(a, b);
+	}
+
+	void visit(bool_expr * e) { last = to.make<bool_expr>(e->val); }
+	void visit(int_expr * e) { last = to.make<int_expr>(e->val); }
+	void visit(ref_expr * e) { last = to.make<ref_expr>(e->declared, number[e->slot], e->values); }
+	void visit(and_expr * e) { binary(e); }
+	void visit(or_expr * e) { binary(e); }
+	void visit(xor_expr * e) { binary(e); }
+	void visit(not_expr * e) { unary(e); }
+	void visit(cond_expr * e)
+	{
+		expr * a = run(e->e1);
+		expr * b = run(e->e2);
+		expr * c = run(e->e3);
+		last = to.make<cond_expr>(a, b, c);
+	}
+	void visit(equal_expr * e) { binary(e); }
+	void visit(not_equal_expr * e) { binary(e); }
+	void visit(less_than_expr * e) { binary(e); }
+	void visit(greater_than_expr * e) { binary(e); }
+	void visit(less_than_eq_expr * e) { binary(e); }
+	void visit(greater_than_eq_expr * e) { binary(e); }
+	void visit(add_expr * e) { binary(e); }
+	void visit(sub_expr * e) { binary(e); }
+	void visit(multi_expr * e) { binary(e); }
+	void visit(div_expr * e) { binary(e); }
+	void visit(rem_expr * e) { binary(e); }
+	void visit(neg_expr * e) { unary(e); }
+	void visit(and_then_expr * e) { binary(e); }
+	void visit(or_else_expr * e) { binary(e); }
+};
+
+// Defers e, which depends on the references recorded since the last thunk,
+// and returns its number
+int thunk_table::add(expr * e)
+{
+	int n = static_cast<int>(thunks.size());
+	thunks.push_back(thunk{ e, deps.size(), pending.size(), false });
+	++made_count;
+	deps.insert(deps.end(), pending.begin(), pending.end());
+	pending.clear();
+
+	if(values->size() <= static_cast<std::size_t>(n))
+	{
+		values->resize(n + 1);
+	}
+	return n;
+}
+
+// Returns the value of thunk n, evaluating it and what it depends on the
+// first time
+long long thunk_table::force(int n)
+{
+	stack.push_back(n);
+	while(!stack.empty())
+	{
+		thunk & t = thunks[stack.back()];
+		if(t.forced)
+		{
+			stack.pop_back();
+			continue;
+		}
+
+		// Leave t on the stack until its dependencies are forced
+		bool ready = true;
+		for(std::size_t i = t.first; i < t.first + t.count; ++i)
+		{
+			if(!thunks[deps[i]].forced)
+			{
+				stack.push_back(deps[i]);
+				ready = false;
+			}
+		}
+		if(!ready)
+		{
+			continue;
+		}
+
+		int slot = stack.back();
+		stack.pop_back();
+		(* values)[slot] = eval(t.e);
+		t.forced = true;
+		++forced_count;
+	}
+	return (* values)[n];
+}
+
+// Keeps the thunks numbered in roots and what they depend on, copying their
+// expressions into to, and drops the rest
+// roots is changed to the new numbers; no thunk may be pending or deferred
+void thunk_table::compact(std::vector<int> & roots, arena & to)
+{
+	// Only an unforced thunk still needs its dependencies
+	std::vector<int> number(thunks.size(), -1);
+	stack.assign(roots.begin(), roots.end());
+	while(!stack.empty())
+	{
+		int n = stack.back();
+		stack.pop_back();
+		if(number[n] >= 0)
+		{
+			continue;
+		}
+
+		number[n] = 0;
+		const thunk & t = thunks[n];
+		if(!t.forced)
+		{
+			stack.insert(stack.end(), deps.begin() + t.first, deps.begin() + t.first + t.count);
+		}
+	}
+
+	// Dependencies come before the thunks that read them, so they are
+	// numbered again before anything refers to them
+	std::vector<thunk> live;
+	std::vector<int> live_deps;
+	thunk_copier copier(to, number);
+	for(std::size_t n = 0; n < thunks.size(); ++n)
+	{
+		if(number[n] < 0)
+		{
+			continue;
+		}
+
+		int slot = static_cast<int>(live.size());
+		number[n] = slot;
+		const thunk & t = thunks[n];
+		if(t.forced)
+		{
+			(* values)[slot] = (* values)[n];
+			live.push_back(thunk{ nullptr, live_deps.size(), 0, true });
+			continue;
+		}
+
+		std::size_t first = live_deps.size();
+		for(std::size_t i = t.first; i < t.first + t.count; ++i)
+		{
+			live_deps.push_back(number[deps[i]]);
+		}
+		live.push_back(thunk{ copier.run(t.e), first, t.count, false });
+	}
+
+	thunks.swap(live);
+	deps.swap(live_deps);
+	values->resize(thunks.size());
+	kept = thunks.size();
+
+	for(int & n : roots)
+	{
+		n = number[n];
+	}
+}
+
+#endif
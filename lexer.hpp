@@ -2,127 +2,144 @@
 #ifndef LEXER_HPP
 #define LEXER_HPP
 
-# include <string>
+# include <climits>
+# include <string_view>
 # include <vector>
-# include <cctype>
 # include "com/context.h"
+# include "com/charclass.hpp"
 # include "ast/token.hpp"
-# include "ast/symbol.hpp"
 # include "ast/keyword.hpp"
+# include "com/interner.hpp"
 
 class lexer
 {
 private:
-	char * current;
-	char * last;
-	std::vector<token *> tokens;
-	symbol_table * sym_tbl;
-	keyword_table * kw_tbl;
+	const char * first;
+	const char * current;
+	const char * last;
+	std::vector<token> * tokens;
+	interner * names;
 
 	bool empty() { return current > last; }
-	char now() { return * current; }
+	char now() { return empty() ? '\0' : * current; }
 	void next() { ++current; }
 	void back() { --current; }
-	bool is_digit(char);
-	token * parse_two(char, token_kind, token_kind);
-	token * parse_amp(char);
-	token * parse_int(char);
-	token * parse_bool(bool);
-	token * parse_binary();
-	token * parse_hex();
-	token * parse_comment();
-	token * parse_word();
+	long long read_digits(unsigned, unsigned long long);
+	long long accumulate(const char *, unsigned, unsigned long long);
+	token make(token_kind, const char *, long long = 0);
+	token parse_two(char, token_kind, token_kind);
+	token parse_amp(char);
+	token parse_int(const char *);
+	token parse_binary(const char *);
+	token parse_hex(const char *);
+	token parse_comment();
+	token parse_word();
 
 public:
-	lexer(symbol_table * sym_tbl, keyword_table * kw_tbl) : sym_tbl(sym_tbl), kw_tbl(kw_tbl) { }
+	lexer(interner * names) : names(names) { }
 	~lexer() { }
 
-	std::vector<token *> lex(std::string);
+	void lex(std::string_view, std::vector<token> &);
 	
 };
 
-std::vector<token *> lexer::lex(std::string str)
+// Lexes str into out, replacing its contents
+// Token spans are offsets into str, nothing is copied out of it
+void lexer::lex(std::string_view str, std::vector<token> & out)
 {
-	tokens.clear();
+	tokens = & out;
+	tokens->clear();
 	if(str.size() == 0)
 	{
-		return tokens;
+		return;
 	}
 
-	current = & str.front();
-	last = & str.back();
+	first = str.data();
+	current = first;
+	last = first + str.size() - 1;
 
 	while(!empty())
 	{
+		// Skip runs of blanks in one step
+		current = skip_space(current, last + 1);
+		if(empty())
+		{
+			break;
+		}
+
+		const char * start = current;
 		char c = now();
 		// std::cout << c << std::endl;
 		switch(c)
 		{
 			case '+':
-				tokens.push_back(new op_token(plus));
+				tokens->push_back(make(plus, start));
 				break;
 			case '-':
-				tokens.push_back(new op_token(minus));
+				tokens->push_back(make(minus, start));
 				break;
 			case '*':
-				tokens.push_back(new op_token(asterisk));
+				tokens->push_back(make(asterisk, start));
 				break;
 			case '/':
-				tokens.push_back(new op_token(forward_slash));
+				tokens->push_back(make(forward_slash, start));
 				break;
 			case '%':
-				tokens.push_back(new op_token(percent));
+				tokens->push_back(make(percent, start));
 				break;
 			case '&':
-				tokens.push_back(parse_two('&', ampersand_ampersand, ampersand));
+				tokens->push_back(parse_two('&', ampersand_ampersand, ampersand));
 				break;
 			case '|':
-				tokens.push_back(parse_two('|', bar_bar, bar));
+				tokens->push_back(parse_two('|', bar_bar, bar));
 				break;
 			case '!':
-				tokens.push_back(parse_two('=', exclamation_equal, exclamation));
+				tokens->push_back(parse_two('=', exclamation_equal, exclamation));
 				break;
 			case '=':
-				next();
-				tokens.push_back(new op_token((now() == '=' ? equal_equal : throw std::exception("Invlaid Token - Attempted '=='"))));
+				tokens->push_back(parse_two('=', equal_equal, equals));
 				break;
 			case '<':
-				tokens.push_back(parse_two('=', less_than_equal, less_than));
+				tokens->push_back(parse_two('=', less_than_equal, less_than));
 				break;
 			case '>':
-				tokens.push_back(parse_two('=', greater_than_equal, greater_than));
+				tokens->push_back(parse_two('=', greater_than_equal, greater_than));
 				break;
 			case '?':
-				tokens.push_back(new op_token(question_mark));
+				tokens->push_back(make(question_mark, start));
 				break;
 			case ':':
-				tokens.push_back(new op_token(colon));
+				tokens->push_back(make(colon, start));
 				break;
 			case '(':
-				tokens.push_back(new op_token(open_parenthesis));
+				tokens->push_back(make(open_parenthesis, start));
 				break;
 			case ')':
-				tokens.push_back(new op_token(close_parenthesis));
+				tokens->push_back(make(close_parenthesis, start));
 				break;
 			case '~':
-				tokens.push_back(new op_token(tilde));
+				tokens->push_back(make(tilde, start));
 				break;
 			case '^':
-				tokens.push_back(new op_token(carat));
+				tokens->push_back(make(carat, start));
 				break;
 			case '#':
-				tokens.push_back(parse_comment());
+				tokens->push_back(parse_comment());
+				break;
+			case ';':
+			case '\n': // newlines separate statements in whole file input
+				tokens->push_back(make(semicolon, start));
 				break;
 			case '0':
 				next();
 				if((c = now()) == 'b')
 				{
-					tokens.push_back(parse_binary());
+					tokens->push_back(parse_binary(start));
 					break;				
 				}
 				else if(c == 'h')
 				{
-					tokens.push_back(parse_hex());
+					tokens->push_back(parse_hex(start));
 					break;
 				}
 			case '1':
@@ -134,176 +151,102 @@ std::vector<token *> lexer::lex(std::string str)
 			case '7':
 			case '8':
 			case '9': // integer
-				tokens.push_back(parse_int(c));
-				break;
-			case 't':
-				tokens.push_back(parse_bool(true));
-				break;
-			case 'f':
-				tokens.push_back(parse_bool(false));
+				tokens->push_back(parse_int(start));
 				break;
 			default:
-				if(std::isalpha(c))
+				if(is_class(c, cc_alpha))
 				{
-					tokens.push_back(parse_word());
+					tokens->push_back(parse_word());
 				}
 				break;
 		}
 
 		next();
 	}
-
-	return tokens;	
 };
 
-token * lexer::parse_int(char c)
+// Makes a token of kind k spanning from start to the current character
+token lexer::make(token_kind k, const char * start, long long val)
 {
-	std::string s;
-
-	while(is_digit((c = now())))
-	{
-		s += c;
-		next();
-	}
-	back();
+	return token(k, start - first, current - start + 1, val);
+}
 
-	try
-	{
-		return new int_token(std::stoi(s));
-	}
-	catch(std::exception e)
+// Reads the digits of a literal in base, starting at the current character
+// and leaving current on the last digit
+// Throws if there are no digits or the value is greater than limit
+long long lexer::read_digits(unsigned base, unsigned long long limit)
+{
+	const char * end = current;
+	while(end <= last && digit_value(* end) < base)
 	{
-		std::cout << e.what() << std::endl;
-		throw e;
+		++end;
 	}
+	return accumulate(end, base, limit);
 }
 
-bool lexer::is_digit(char c)
-{	
-	return 
-		c == '0' || 
-		c == '1' || 
-		c == '2' || 
-		c == '3' || 
-		c == '4' || 
-		c == '5' || 
-		c == '6' || 
-		c == '7' || 
-		c == '8' || 
-		c == '9';
-}
-
-token * lexer::parse_bool(bool b)
+// Computes the value of the digits from the current character up to end,
+// leaving current on the last digit
+// Throws if there are no digits or the value is greater than limit
+long long lexer::accumulate(const char * end, unsigned base, unsigned long long limit)
 {
-	next();
-	if(b)
+	if(current == end)
 	{
-		if(now() == 'r')
-		{
-			next();
-			if(now() == 'u')
-			{
-				next();
-				if(now() == 'e')
-				{
-					return new bool_token(true);
-				}
-			}
-		}
+		throw std::exception("Invalid Integer Literal");
 	}
-	else
+
+	unsigned long long val = 0;
+	for(; current < end; next())
 	{
-		if(now() == 'a')
+		unsigned d = digit_value(now());
+		if(val > (limit - d) / base)
 		{
-			next();
-			if(now() == 'l')
-			{
-				next();
-				if(now() == 's')
-				{
-					next();
-					if(now() == 'e')
-					{
-						return new bool_token(false);						
-					}
-				}
-			}
-		}		
+			throw std::exception("Integer Literal Out Of Range");
+		}
+		val = val * base + d;
 	}
 
-	throw std::exception("Invalid Boolean Format");
+	back();
+	return static_cast<long long>(val);
 }
 
-token * lexer::parse_two(char secondary, token_kind double_kind, token_kind single_kind)
+token lexer::parse_int(const char * start)
 {
+	// Rescan from the first digit, the '0' case may have stepped past it,
+	// finding the run with the vector scanner before adding it up
+	current = start;
+	return make(int_literal, start, accumulate(scan_digits(start, last + 1), 10, LLONG_MAX));
+}
+
+token lexer::parse_two(char secondary, token_kind double_kind, token_kind single_kind)
+{
+	const char * start = current;
 	next();
 	if(now() == secondary)
 	{
-		return new op_token(double_kind);
+		return make(double_kind, start);
 	}
 	else
 	{
 		back();
-		return new op_token(single_kind);
+		return make(single_kind, start);
 	}
 }
 
-token * lexer::parse_binary()
+// Binary and hex literals may set all 64 bits, the top one being the sign
+token lexer::parse_binary(const char * start)
 {
-	std::string s;
-
 	next();
-	char c = now();
-
-	while(c == '1' || c == '0')
-	{
-		s += c;
-		next();
-		c = now();
-	}
-	back();
-
-	try
-	{
-		return new binary_token(std::stoi(s, nullptr, 2));
-	}
-	catch(std::exception e)
-	{
-		std::cout << e.what() << std::endl;
-		throw e;
-	}
+	return make(binary_literal, start, read_digits(2, ULLONG_MAX));
 }
 
-token * lexer::parse_hex()
+token lexer::parse_hex(const char * start)
 {
-	std::string s;
-
 	next();
-	char c = now();
-
-	while(c == '0' || c == '1' || c == '2' || c == '3' || c == '4' || c == '5' || c == '6' || c == '7'
-		 || c == '8' || c == '9' || c == 'A' || c == 'B' || c == 'C' || c == 'D' || c == 'E' || c == 'F')
-	{
-		s += c;
-		next();
-		c = now();
-	}
-	back();
-
-	try
-	{
-		return new hex_token(std::stoi(s, nullptr, 16));
-	}
-	catch(std::exception e)
-	{
-		std::cout << e.what() << std::endl;
-		throw e;
-	}
+	return make(hex_literal, start, read_digits(16, ULLONG_MAX));
 }
 
-token * lexer::parse_comment()
+token lexer::parse_comment()
 {
-	std::string s;	
 	char c = now();
 
 	// skip any initial whitespace
@@ -313,44 +256,32 @@ token * lexer::parse_comment()
 	}
 	while((c = now()) == ' ');
 
-
-	while(!empty())
+	// the comment runs to the end of the line
+	const char * start = current;
+	while(!empty() && now() != '\n')
 	{
-		s += now();
 		next();
 	}
+	back();
 
-	return new comment_token(s);
+	return make(comment_literal, start);
 }
 
-token * lexer::parse_word()
+token lexer::parse_word()
 {
-	std::string s;	
-	char c = now();
-
-	// skip any initial whitespace
-	while((c = now()) == ' ')
-	{
-		next();
-	};
+	const char * start = current;
 
-	// get the string
-	while(!empty())
-	{
-		s += now();
-		next();
-	}
+	// get the span of the word
+	current = scan_word(start, last + 1);
+	back();
 
-	if(kw_tbl->count(s) > 0)
+	std::string_view s(start, current - start + 1);
+	if(const keyword * k = keywords.find(s))
 	{
-		switch(kw_tbl->at(s))
-		{
-			case token_kind::variable_literal:
-				return new var_token();
-		}
+		return make(k->kind, start, k->val);
 	}
 
-	return new id_token(s);
+	return make(identifier, start, names->intern(s));
 }
 
 #endif
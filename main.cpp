@@ -1,16 +1,32 @@
 
+# include <chrono>
+# include <cstdio>
+# include <cstdlib>
 # include <iostream>
+# include <iterator>
 # include <string>
+# include <string_view>
 # include <vector>
 
 # include "ast/expression.hpp"
 # include "lexer.hpp"
 # include "print.hpp"
 # include "parser.hpp"
+# include "parallel.hpp"
+# include "pipeline.hpp"
+# include "bench.hpp"
+# include "codegen.hpp"
+# include "image.hpp"
 # include "com/context.h"
+# include "com/source.hpp"
 
-// Global context instantiation
-context * ctx = new context();
+# ifdef _WIN32
+# include <io.h>
+# define isatty _isatty
+# define fileno _fileno
+# else
+# include <unistd.h>
+# endif
 
 // void test_expr()
 // {
@@ -70,21 +86,77 @@ output_format getOutputFormat(int argc, char * argv[])
 	return output_format::decimal;
 }
 
+// Returns true if flag was given
+bool hasFlag(int argc, char * argv[], std::string flag)
+{
+	for(int i = 1; i < argc; ++i)
+	{
+		if(flag == argv[i])
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Returns the argument following flag, or nullptr if flag was not given
+const char * getArgument(int argc, char * argv[], std::string flag)
+{
+	for(int i = 1; i + 1 < argc; ++i)
+	{
+		if(flag == argv[i])
+		{
+			return argv[i + 1];
+		}
+	}
+
+	return nullptr;
+}
+
+// Applies the parser options given on the command line
+// -O	constant fold expressions before evaluating them
+// -S	share structurally identical subtrees
+// -J n	compile cached lines to native code after n evaluations, with -L
+// -W n	evaluate large expressions on n threads
+// -L n	cache what repeated lines parse to, in at most n KiB
+// -Z	evaluate lazily, printing only expression statements
+void configure(parser & prsr, int argc, char * argv[])
+{
+	prsr.set_folding(hasFlag(argc, argv, "-O"));
+	prsr.set_sharing(hasFlag(argc, argv, "-S"));
+	if(const char * n = getArgument(argc, argv, "-J"))
+	{
+		prsr.set_jit(static_cast<unsigned>(std::strtoul(n, nullptr, 10)));
+	}
+	if(const char * n = getArgument(argc, argv, "-W"))
+	{
+		prsr.set_workers(std::strtoul(n, nullptr, 10));
+	}
+	if(const char * n = getArgument(argc, argv, "-L"))
+	{
+		prsr.set_cache(std::strtoul(n, nullptr, 10) * 1024);
+	}
+	prsr.set_lazy(hasFlag(argc, argv, "-Z"));
+}
+
 // void test_lexer(int argc, char * argv[])
 // {
 // 	output_format format = getOutputFormat(argc, argv);
 
 // 	lexer lx;
+// 	writer out;
 // 	std::string str;
 
 // 	while(getline(std::cin, str))
 // 	{
-// 		std::vector<token *> tokens = lx.lex(str);
+// 		std::vector<token> tokens;
+// 		lx.lex(str, tokens);
 // 		for(int i = 0; i < tokens.size(); ++i)
 // 		{
-// 			print(tokens.at(i), format);
+// 			print(tokens.at(i), str, format, out);
 // 		}
-// 		std::cout << std::endl;
+// 		out.put('\n');
 // 	}	
 // }
 
@@ -94,15 +166,325 @@ void test_parser(int argc, char * argv[])
 
 	parser prsr;
 	std::string str;
+	configure(prsr, argc, argv);
+
+	// Results are only flushed per line when someone is typing them
+	bool interactive = isatty(fileno(stdin));
 
 	while(getline(std::cin, str))
 	{
 		prsr.parse(str, format);
+		if(interactive)
+		{
+			prsr.flush();
+		}
 	}
 }
 
-int main(int argc, char * argv[])
+// Size of the blocks whole file input is parsed in
+const std::size_t block_size = 1 << 20;
+
+// Parses text a block at a time, splitting each block after its last newline
+// Returns the number of bytes parsed; a trailing partial line is left over
+template<typename P>
+std::size_t parse_blocks(P & prsr, std::string_view text, output_format format, bool final)
+{
+	std::size_t done = 0;
+
+	while(done < text.size())
+	{
+		std::string_view rest = text.substr(done);
+		std::size_t n = rest.size();
+
+		if(n > block_size || !final)
+		{
+			std::size_t nl = rest.rfind('\n', block_size);
+			if(nl == std::string_view::npos)
+			{
+				// A single line longer than a block is parsed whole
+				nl = final ? n - 1 : rest.find('\n');
+				if(nl == std::string_view::npos)
+				{
+					break;
+				}
+			}
+			n = nl + 1;
+		}
+
+		prsr.parse(rest.substr(0, n), format);
+		done += n;
+	}
+
+	return done;
+}
+
+// Maps the file (or reads stdin when the path is "-") and parses it in large
+// blocks with newlines and semicolons separating statements
+// Returns the number of bytes read
+template<typename P>
+std::size_t parse_file(P & prsr, const char * path, output_format format)
+{
+	std::size_t total = 0;
+
+	if(std::string(path) == "-")
+	{
+		std::string buf;
+		std::vector<char> block(block_size);
+		std::size_t n;
+
+		while((n = std::fread(block.data(), 1, block.size(), stdin)) > 0)
+		{
+			buf.append(block.data(), n);
+			buf.erase(0, parse_blocks(prsr, buf, format, false));
+			total += n;
+		}
+		parse_blocks(prsr, buf, format, true);
+	}
+	else
+	{
+		mapped_file file(path);
+		total = file.view().size();
+		parse_blocks(prsr, file.view(), format, true);
+	}
+
+	prsr.flush();
+	return total;
+}
+
+// Whole file input
+// Parses the file with one parser, or with -T n on n threads, then reports
+// the throughput on std::cerr
+void test_file(const char * path, int argc, char * argv[])
+{
+	output_format format = getOutputFormat(argc, argv);
+	std::size_t total;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if(const char * n = getArgument(argc, argv, "-T"))
+	{
+		parallel_parser prsr(std::strtoul(n, nullptr, 10));
+		for(std::size_t i = 0; i < prsr.workers(); ++i)
+		{
+			configure(prsr.worker(i), argc, argv);
+		}
+		total = parse_file(prsr, path, format);
+	}
+	else
+	{
+		parser prsr;
+		configure(prsr, argc, argv);
+		total = parse_file(prsr, path, format);
+
+		if(const line_cache * c = prsr.cache())
+		{
+			std::cerr << "line cache: " << c->hits() << " hits, " << c->misses() << " misses, "
+				<< c->evictions() << " evictions, " << c->size() << " lines in " << c->bytes() << " bytes" << std::endl;
+		}
+		if(const thunk_table * t = prsr.thunks())
+		{
+			std::cerr << "lazy: " << t->forced() << " of " << t->size() << " thunks evaluated" << std::endl;
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "read " << total << " bytes in " << seconds << " s ("
+		<< (total / 1000000.0) / seconds << " MB/s)" << std::endl;
+}
+
+// Parses the file at path ("-" for stdin) with lexing, parsing, evaluation
+// and output running as separate stages on their own threads
+void test_pipeline(const char * path, int argc, char * argv[])
+{
+	bool input = std::string(path) == "-";
+	std::FILE * in = input ? stdin : std::fopen(path, "rb");
+	if(in == nullptr)
+	{
+		throw std::exception("Cannot open input file");
+	}
+
+	pipeline stages;
+	configure(stages.syntax(), argc, argv);
+	stages.run(in);
+
+	if(!input)
+	{
+		std::fclose(in);
+	}
+}
+
+// Writes the program read from path ("-" for stdin) as a C translation unit
+// on stdout instead of evaluating it
+void compile_file(const char * path, int argc, char * argv[])
 {
+	parser prsr;
+	configure(prsr, argc, argv);
+	writer out;
+
+	if(std::string(path) == "-")
+	{
+		std::string text((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+		emit_c(prsr.parse_statements(text), out);
+	}
+	else
+	{
+		mapped_file file(path);
+		emit_c(prsr.parse_statements(file.view()), out);
+	}
+}
+
+// Parses the program read from path ("-" for stdin) and writes it to the
+// file at out as an image
+void write_image_file(const char * path, const char * out, int argc, char * argv[])
+{
+	parser prsr;
+	configure(prsr, argc, argv);
+	std::FILE * file = std::fopen(out, "wb");
+	if(file == nullptr)
+	{
+		throw std::exception("Cannot open image file");
+	}
+
+	{
+		writer w(file);
+		if(std::string(path) == "-")
+		{
+			std::string text((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+			write_image(prsr.parse_statements(text), w);
+		}
+		else
+		{
+			mapped_file source(path);
+			write_image(prsr.parse_statements(source.view()), w);
+		}
+	}
+	std::fclose(file);
+}
+
+// Lexes the program read from path ("-" for stdin) and writes its tokens
+// to the file at out
+void write_tokens_file(const char * path, const char * out)
+{
+	std::FILE * file = std::fopen(out, "wb");
+	if(file == nullptr)
+	{
+		throw std::exception("Cannot open token stream file");
+	}
+
+	{
+		writer w(file);
+		if(std::string(path) == "-")
+		{
+			std::string text((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+			write_tokens(text, w);
+		}
+		else
+		{
+			mapped_file source(path);
+			write_tokens(source.view(), w);
+		}
+	}
+	std::fclose(file);
+}
+
+// Maps the token stream at path and parses and evaluates it without lexing
+void replay_file(const char * path, int argc, char * argv[])
+{
+	mapped_file file(path);
+	token_stream ts(file.view());
+	parser prsr;
+	configure(prsr, argc, argv);
+	prsr.replay(ts);
+	prsr.flush();
+}
+
+// Maps the image at path and prints the value of each of its statements
+// without lexing or parsing anything
+void run_image(const char * path)
+{
+	mapped_file file(path);
+	image img(file.view());
+	std::vector<long long> values;
+	writer out;
+
+	for(std::size_t i = 0; i < img.statements(); ++i)
+	{
+		out.put_int(img.evaluate(i, values));
+		out.put('\n');
+	}
+}
+
+int run(int argc, char * argv[])
+{
+	if(argc > 2 && std::string(argv[1]) == "-bench")
+	{
+		return run_bench(argv[2]);
+	}
+
+	if(const char * path = getArgument(argc, argv, "-i"))
+	{
+		run_image(path);
+		return 0;
+	}
+
+	if(const char * path = getArgument(argc, argv, "-r"))
+	{
+		replay_file(path, argc, argv);
+		return 0;
+	}
+
+	if(hasFlag(argc, argv, "-P"))
+	{
+		const char * path = getArgument(argc, argv, "-f");
+		test_pipeline(path ? path : "-", argc, argv);
+		return 0;
+	}
+
+	if(const char * path = getArgument(argc, argv, "-f"))
+	{
+		if(hasFlag(argc, argv, "-C"))
+		{
+			compile_file(path, argc, argv);
+			return 0;
+		}
+
+		if(const char * out = getArgument(argc, argv, "-o"))
+		{
+			write_image_file(path, out, argc, argv);
+			return 0;
+		}
+
+		if(const char * out = getArgument(argc, argv, "-t"))
+		{
+			write_tokens_file(path, out);
+			return 0;
+		}
+
+		test_file(path, argc, argv);
+		return 0;
+	}
+
+	// Lines read from stdin are parsed in parallel as one stream
+	if(getArgument(argc, argv, "-T"))
+	{
+		test_file("-", argc, argv);
+		return 0;
+	}
+
 	test_parser(argc, argv);
 	return 0;
+}
+
+int main(int argc, char * argv[])
+{
+	// Unwinding destroys the writers, which writes every result produced
+	// before the error
+	try
+	{
+		return run(argc, argv);
+	}
+	catch(const std::exception & e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
 }
\ No newline at end of file
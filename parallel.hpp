@@ -0,0 +1,165 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+# include <algorithm>
+# include <cstddef>
+# include <exception>
+# include <memory>
+# include <string>
+# include <string_view>
+# include <vector>
+
+# include "parser.hpp"
+# include "print.hpp"
+# include "com/thread_pool.hpp"
+# include "com/writer.hpp"
+
+// *************************************************************************** //
+// Parallel parser class
+//
+// Summary:
+//		- Splits its input into chunks of whole lines and lexes, parses and
+//			evaluates the chunks on a thread pool, one parser per worker.
+//		- Each chunk's results collect in a string and are written in input
+//			order once the round of chunks it belongs to is done, so the
+//			output is the same as a single parser's.
+//		- An error in a chunk is rethrown after the results of the chunks
+//			before it have been written.
+//		- Lines are only independent until the first declaration: a later
+//			line may read the variable, and every parser has its own symbol
+//			table. Once the text of a call contains "var" every later call
+//			runs on the first parser alone, in order.
+//
+// *************************************************************************** //
+class parallel_parser
+{
+private:
+	thread_pool pool;
+	std::vector<std::string> buffers;
+	std::vector<std::unique_ptr<parser>> parsers;
+	std::vector<std::string_view> chunks;
+	std::vector<std::string> results;
+	std::vector<std::exception_ptr> errors;
+	writer out;
+	std::size_t chunk_size;
+	bool sequential;
+
+	void split(std::string_view);
+	void round(std::size_t, std::size_t, output_format);
+
+public:
+	// Runs on threads workers, handing them chunk_size bytes at a time
+	parallel_parser(std::size_t threads, std::size_t chunk_size = 64 * 1024, std::FILE * file = stdout)
+		: pool(threads), buffers(pool.size()), out(file), chunk_size(chunk_size), sequential(false)
+	{
+		for(std::string & b : buffers)
+		{
+			parsers.emplace_back(new parser(& b));
+		}
+	}
+
+	parallel_parser(const parallel_parser &) = delete;
+	parallel_parser & operator=(const parallel_parser &) = delete;
+
+	void parse(std::string_view, output_format);
+
+	// Number of workers, and the parser each one uses
+	std::size_t workers() const { return parsers.size(); }
+	parser & worker(std::size_t i) { return * parsers[i]; }
+
+	// Writes any buffered results
+	void flush() { out.flush(); }
+};
+
+// Splits s into chunks of about chunk_size bytes that end after a newline
+void parallel_parser::split(std::string_view s)
+{
+	chunks.clear();
+	while(!s.empty())
+	{
+		std::size_t n = s.size();
+		if(n > chunk_size)
+		{
+			std::size_t nl = s.find('\n', chunk_size - 1);
+			n = nl == std::string_view::npos ? n : nl + 1;
+		}
+		chunks.push_back(s.substr(0, n));
+		s.remove_prefix(n);
+	}
+}
+
+// Parses chunks [first, first + n) in parallel, then writes their results
+void parallel_parser::round(std::size_t first, std::size_t n, output_format format)
+{
+	pool.run(n, [&](std::size_t i, std::size_t w)
+	{
+		std::size_t c = first + i;
+		try
+		{
+			parsers[w]->parse(chunks[c], format);
+		}
+		catch(...)
+		{
+			errors[c] = std::current_exception();
+		}
+
+		// Hand the results over and keep the old string's capacity
+		parsers[w]->flush();
+		results[c].swap(buffers[w]);
+		buffers[w].clear();
+	});
+
+	for(std::size_t c = first; c < first + n; ++c)
+	{
+		out.put(results[c]);
+		results[c].clear();
+		if(errors[c])
+		{
+			std::exception_ptr e = errors[c];
+			errors[c] = nullptr;
+			out.flush();
+			std::rethrow_exception(e);
+		}
+	}
+}
+
+void parallel_parser::parse(std::string_view s, output_format format)
+{
+	sequential = sequential || s.find("var") != std::string_view::npos;
+	if(sequential)
+	{
+		parser & p = * parsers.front();
+		std::exception_ptr error;
+		try
+		{
+			p.parse(s, format);
+		}
+		catch(...)
+		{
+			error = std::current_exception();
+		}
+		p.flush();
+		out.put(buffers.front());
+		buffers.front().clear();
+		if(error)
+		{
+			out.flush();
+			std::rethrow_exception(error);
+		}
+		return;
+	}
+
+	split(s);
+	results.resize(std::max(results.size(), chunks.size()));
+	errors.resize(std::max(errors.size(), chunks.size()));
+
+	// A few chunks per worker evens out chunks that take longer than others
+	// while bounding the results held before they are written
+	std::size_t per_round = workers() * 4;
+	for(std::size_t first = 0; first < chunks.size(); first += per_round)
+	{
+		round(first, std::min(per_round, chunks.size() - first), format);
+	}
+}
+
+#endif
@@ -1,26 +1,62 @@
 
+#ifndef PARSER_HPP
+#define PARSER_HPP
+
 # include "lexer.hpp"
 # include "print.hpp"
+# include "fold.hpp"
+# include "cache.hpp"
+# include "stream.hpp"
+# include "lazy.hpp"
+# include "bytecode.hpp"
 # include "ast/token.hpp"
+# include "com/arena.hpp"
+# include "com/trace.hpp"
+# include "com/writer.hpp"
 #include "ast/statement.hpp"
 #include "ast/declaration.hpp"
+#include "ast/factory.hpp"
+#include "ast/symbol.hpp"
 
+# include <exception>
+# include <map>
+# include <memory>
 # include <string>
+# include <string_view>
 # include <vector>
 
 class parser
 {
 private:
-	std::vector<token *> tokens;
+	std::vector<token> tokens;
+	std::vector<stmt *> seq;
+	interner names;
 	symbol_table sym_tbl;
-	keyword_table kw_tbl;
+	std::vector<long long> values;
+	arena arn;
+	node_factory nodes;
+	eval_memo memo;
+	jit native;
+	std::unique_ptr<fork_evaluator> forking;
+	std::unique_ptr<line_cache> lines;		// after native, whose code it holds
+	std::unique_ptr<thunk_table> lazy;
+	std::vector<int> deferred;
+	vm machine;
+	std::map<std::pair<unsigned, type *>, int> homes;
+	std::vector<binding> * log;
+	unsigned epoch;
+	writer out;
+	bool folding;
+	bool sharing;
+	bool compiling;
+	bool deferring;
 	lexer * lxr;
 
-	token ** current;
-	token ** last;
+	token * current;
+	token * last;
 
 	bool empty() { return current > last; }
-	token * now() { return * current; }
+	token * now() { return current; }
 	void next() { ++current; }
 	void back() { --current; }
 
@@ -29,9 +65,25 @@ private:
 	token * match_if(token_kind);
 	token * match(token_kind);
 	token * consume();
+	void trace_rule(const char *);
+	expr * optimize(expr * e) { return folding ? fold(e, arn) : e; }
+
+	// Makes an expression node, reusing an identical one when sharing
+	template<typename T, typename... Args>
+	T * make(Args... args) { return sharing ? nodes.make<T>(args...) : arn.make<T>(args...); }
+
+	// Releases the syntax tree of the last parse
+	void release() { arn.reset(); nodes.clear(); }
+
+	void parse_lines(std::string_view);
+	std::exception_ptr lex(std::string_view);
+	void collect();
+	void compile_line(line_cache::entry &);
+	void put(long long val) { out.put_int(val); out.put('\n'); }
 
 	// Recursive Parsing
 	
+	std::vector<stmt *> parse_tokens();
 	std::vector<stmt *> statement_seq();
 
 	// Statements
@@ -60,16 +112,113 @@ private:
 	expr * primary_expression();
 	expr * id_expression();
 
-	std::string * identifier();
+	unsigned identifier();
+	int declare(unsigned, expr *);
 
 public:
-	parser()
+	parser(std::FILE * file = stdout) : nodes(arn), log(nullptr), epoch(0), out(file), folding(false), sharing(false), compiling(false), deferring(false)
+	{
+		lxr = new lexer(& names);
+		native.bind(& values);
+	}
+
+	// Appends the results to text instead of writing them to a file
+	parser(std::string * text) : nodes(arn), log(nullptr), epoch(0), out(text), folding(false), sharing(false), compiling(false), deferring(false)
 	{
-		lxr = new lexer(& sym_tbl, & kw_tbl);
+		lxr = new lexer(& names);
+		native.bind(& values);
 	}
 	~parser() { }
 	
-	void parse(std::string, output_format);
+	void parse(std::string_view, output_format);
+	std::vector<stmt *> parse_statements(std::string_view);
+	std::vector<stmt *> parse_tokens(std::vector<token> &);
+	void replay(const token_stream &);
+	std::vector<int> parse_deferred(std::string_view);
+
+	// Returns the value of an expression statement parse_deferred() deferred
+	long long value(int n) { return lazy->force(n); }
+	std::vector<stmt *> parse_line(std::vector<token> &, std::vector<binding> *);
+
+	// The statements the last parse made before it failed
+	const std::vector<stmt *> & parsed() const { return seq; }
+
+	// Drops the tokens after the last semicolon, the statement a lexer
+	// error stopped in, so the statements before it can still be parsed
+	static void trim(std::vector<token> & lexed)
+	{
+		std::size_t n = lexed.size();
+		while(n > 0 && lexed[n - 1].kind != token_kind::semicolon)
+		{
+			--n;
+		}
+		lexed.resize(n);
+	}
+
+	// The variable name is bound to, with no type if it is not declared
+	symbol bound(unsigned name) { return sym_tbl[name]; }
+
+	// Undoes or redoes a binding recorded by parse_line()
+	void unbind(const binding & b) { sym_tbl[b.name] = b.before; ++epoch; }
+	void rebind(const binding & b) { sym_tbl[b.name] = b.after; ++epoch; }
+
+	// Releases every syntax tree and forgets every declaration
+	void reset()
+	{
+		release();
+		sym_tbl = symbol_table();
+		++epoch;
+	}
+
+	// Moves the syntax tree of the last parse into a, which keeps it alive
+	// while this parser goes on to the next input, and takes a's blocks
+	// in exchange
+	void hand_over(arena & a)
+	{
+		nodes.clear();
+		arn.swap(a);
+	}
+
+	// Constant folds every statement's expression when on
+	void set_folding(bool on) { folding = on; }
+
+	// Shares structurally identical subtrees of a parse when on
+	void set_sharing(bool on) { sharing = on; }
+
+	// Compiles the statements of a line the line cache answers to native
+	// code once it has been evaluated threshold times, 0 keeps them in
+	// bytecode; without set_cache() nothing is compiled
+	void set_jit(unsigned threshold)
+	{
+		compiling = threshold != 0 && jit::supported;
+		native.set_threshold(threshold);
+	}
+
+	// Evaluates large expressions on n threads, 0 or 1 keeps them on this one
+	void set_workers(std::size_t n) { forking.reset(n > 1 ? new fork_evaluator(n) : nullptr); }
+
+	// Caches what repeated lines parse to in at most bytes, 0 turns the
+	// cache off
+	void set_cache(std::size_t bytes) { lines.reset(bytes > 0 ? new line_cache(bytes, & native) : nullptr); }
+
+	// Defers declarations and expression statements to thunks when on, so
+	// parse() only evaluates what the expression statements read
+	void set_lazy(bool on) { lazy.reset(on ? new thunk_table(& values) : nullptr); }
+
+	// The thunks of lazy mode, or nullptr when it is off
+	const thunk_table * thunks() const { return lazy.get(); }
+
+	// The line cache, or nullptr when it is off
+	const line_cache * cache() const { return lines.get(); }
+
+	// Writes any buffered results
+	void flush() { out.flush(); }
+
+	// Bytes currently held by the parser's arena
+	std::size_t arena_reserved() const { return arn.reserved(); }
+
+	// Distinct expression nodes of the last parse when sharing
+	std::size_t shared_nodes() const { return nodes.size(); }
 };
 
 token*
@@ -77,7 +226,7 @@ parser::peek()
 {
 	if(!empty())
 	{
-		return *current;
+		return current;
 	}
 
 	return nullptr;
@@ -120,32 +269,371 @@ parser::match(token_kind k)
 
 token * parser::consume()
 {
-	token * t = *current;
+	token * t = current;
 	next();
 	return t;
 }
 
-void parser::parse(std::string s, output_format format)
+// Traces entry into a grammar rule along with the lookahead token
+void parser::trace_rule(const char * rule)
+{
+	if constexpr (trace_enabled)
+	{
+		trace(rule, lookahead(), empty() ? 0 : current->pos);
+	}
+}
+
+void parser::parse(std::string_view s, output_format format)
 {
+	// Declarations are only evaluated when an expression reads them
+	if(lazy)
+	{
+		std::vector<int> outputs;
+		try
+		{
+			outputs = parse_deferred(s);
+		}
+		catch(...)
+		{
+			for(int n : deferred)
+			{
+				put(lazy->force(n));
+			}
+			throw;
+		}
+
+		for(int n : outputs)
+		{
+			put(lazy->force(n));
+		}
+		return;
+	}
+
+	if(lines)
+	{
+		parse_lines(s);
+		return;
+	}
+
+	std::vector<stmt *> statements;
+	try
+	{
+		statements = parse_statements(s);
+	}
+	catch(...)
+	{
+		// The statements before an error are still evaluated, as they are
+		// when input is parsed a line at a time
+		for(stmt * st : seq)
+		{
+			put(st->evaluate());
+		}
+		release();
+		throw;
+	}
+
+	for(stmt * st : statements)
+	{
+		put(st->evaluate());
+	}
+
+	// Release the tokens and syntax tree of this parse
+	release();
+}
+
+// Parses and evaluates s a line at a time, answering repeated lines from
+// the line cache
+void parser::parse_lines(std::string_view s)
+{
+	// Derived statement visitor class
+	// Compiles the expression statements of a line for the cache
+	// Declarations, and expressions too large to fit, keep the line out
+	class compiler : public stmt::visitor
+	{
+	public:
+		line_cache::entry * e;
+		std::size_t limit;
+		bool skip;
+		compiler(line_cache::entry * e, std::size_t limit) : e(e), limit(limit), skip(false) { }
+		void visit(expr_stmt * s)
+		{
+			// A shared subtree compiles once per use
+			if(skip || s->e->size > limit)
+			{
+				skip = true;
+				return;
+			}
+			e->programs.push_back(compile(s->e));
+			e->constant = e->constant && e->programs.back().values == nullptr;
+		}
+		void visit(decl_stmt *) { skip = true; }
+	};
+
+	while(!s.empty())
+	{
+		std::size_t n = s.find('\n');
+		std::string_view line = s.substr(0, n);
+		s.remove_prefix(n == std::string_view::npos ? s.size() : n + 1);
+
+		std::uint64_t h = hash_line(line);
+		if(line_cache::entry * e = lines->find(h, line, epoch))
+		{
+			if(e->constant)
+			{
+				for(long long val : e->results)
+				{
+					put(val);
+				}
+			}
+			else
+			{
+				if(compiling && e->natives.empty() && ++e->runs >= native.threshold())
+				{
+					compile_line(* e);
+				}
+
+				// The native code declines the divisions that would trap,
+				// the bytecode throws on them
+				for(std::size_t i = 0; i < e->programs.size(); ++i)
+				{
+					long long val;
+					if(i < e->natives.size() && e->natives[i] && e->natives[i](& val, native.frame()))
+					{
+						put(val);
+					}
+					else
+					{
+						put(machine.run(e->programs[i]));
+					}
+				}
+			}
+			continue;
+		}
+
+		line_cache::entry e = line_cache::entry();
+		e.line = line;
+		e.hash = h;
+		e.constant = true;
+		compiler c(& e, lines->capacity() / sizeof(instruction));
+		for(stmt * st : parse_statements(line))
+		{
+			e.results.push_back(st->evaluate());
+			put(e.results.back());
+			st->accept(c);
+		}
+		release();
+
+		if(!c.skip)
+		{
+			if(!e.constant)
+			{
+				e.results.clear();
+				e.results.shrink_to_fit();
+			}
+			e.epoch = epoch;
+			e.runs = 1;
+			lines->insert(std::move(e));
+		}
+	}
+}
+
+// Parses the line of a cache entry again to compile its statements to
+// native code, which stays with the entry
+// A statement the jit cannot compile keeps running its bytecode
+void parser::compile_line(line_cache::entry & e)
+{
+	for(stmt * st : parse_statements(e.line))
+	{
+		e.natives.push_back(native.compile(static_cast<expr_stmt *>(st)->e));
+	}
+	release();
+}
+
+// Lexes and parses s without evaluating it
+// The statements stay valid until the next call on this parser
+std::vector<stmt *> parser::parse_statements(std::string_view s)
+{
+	// Release the syntax tree of the previous call
+	release();
+
 	// Lex the tokens from the string input
-	tokens = lxr->lex(s);
+	std::exception_ptr error = lex(s);
+	std::vector<stmt *> statements = parse_tokens();
+	if(error)
+	{
+		std::rethrow_exception(error);
+	}
+	return statements;
+}
+
+// Lexes s into tokens and returns the lexer's error, if any, instead of
+// throwing it
+// After an error the tokens end with the last statement before the bad
+// token, so the statements before it can still be parsed
+std::exception_ptr parser::lex(std::string_view s)
+{
+	try
+	{
+		lxr->lex(s, tokens);
+	}
+	catch(...)
+	{
+		trim(tokens);
+		return std::current_exception();
+	}
+	return nullptr;
+}
+
+// Parses tokens lexed by another lexer, which must intern names
+// into the same ids on every call; the tokens are exchanged for the
+// parser's previous ones so neither vector is reallocated
+std::vector<stmt *> parser::parse_tokens(std::vector<token> & lexed)
+{
+	release();
+	tokens.swap(lexed);
+
+	return parse_tokens();
+}
+
+// Parses and evaluates a token stream without lexing it, a block of
+// tokens at a time
+void parser::replay(const token_stream & ts)
+{
+	std::vector<unsigned> ids = ts.bind(names);
+	std::vector<token> block;
+	token_stream::cursor at = { 0, 0 };
+
+	while(ts.read(at, 64 * 1024, ids, block))
+	{
+		std::vector<stmt *> statements;
+		try
+		{
+			statements = parse_tokens(block);
+		}
+		catch(...)
+		{
+			// The statements before an error are still evaluated, as parse()
+			// evaluates them
+			for(stmt * st : seq)
+			{
+				put(st->evaluate());
+			}
+			release();
+			throw;
+		}
+
+		for(stmt * st : statements)
+		{
+			put(st->evaluate());
+		}
+	}
+
+	release();
+}
+
+// Drops the thunks of lazy mode no name is bound to any more, and their
+// syntax trees, once enough have been made since the last time
+void parser::collect()
+{
+	if(!lazy->due())
+	{
+		return;
+	}
+
+	std::vector<int> roots;
+	sym_tbl.each([&](symbol & s) { roots.push_back(s.slot); });
+
+	arena kept;
+	lazy->compact(roots, kept);
+
+	std::size_t i = 0;
+	sym_tbl.each([&](symbol & s) { s.slot = roots[i++]; });
+
+	// The old trees are freed with kept
+	release();
+	arn.swap(kept);
+	++epoch;
+}
+
+// Parses s into thunks without evaluating anything, and returns the numbers
+// of its expression statements in order
+// The syntax trees are kept, since later input may read any variable
+// declared in s; lazy mode must be on
+// The numbers are valid until the next call, which may drop the thunks
+// that can no longer be read
+std::vector<int> parser::parse_deferred(std::string_view s)
+{
+	collect();
+	std::exception_ptr error = lex(s);
+	deferred.clear();
+
+	deferring = true;
+	try
+	{
+		parse_tokens();
+	}
+	catch(...)
+	{
+		deferring = false;
+		throw;
+	}
+	deferring = false;
+
+	if(error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	return deferred;
+}
+
+// Parses one line of tokens lexed by another lexer, keeping the
+// statements of earlier calls alive, and appends the bindings its
+// declarations change to bindings
+// The tokens are handed back afterwards so the line can be parsed again
+std::vector<stmt *> parser::parse_line(std::vector<token> & lexed, std::vector<binding> * bindings)
+{
+	tokens.swap(lexed);
+	log = bindings;
+
+	std::vector<stmt *> statements;
+	try
+	{
+		statements = parse_tokens();
+	}
+	catch(...)
+	{
+		log = nullptr;
+		tokens.swap(lexed);
+		throw;
+	}
+
+	log = nullptr;
+	tokens.swap(lexed);
+	return statements;
+}
+
+// Parses the lexed tokens
+std::vector<stmt *> parser::parse_tokens()
+{
+	seq.clear();
+	if(tokens.empty())
+	{
+		return std::vector<stmt *>();
+	}
 
 	// Set the current token ptr and the last token ptr
-	current = &tokens.front();
-	last = &tokens.back();
+	current = tokens.data();
+	last = tokens.data() + tokens.size() - 1;
 
 	// Loop through the lexed tokens
 	// while(!empty())
 	// {
-	// 	print(*current, format);
+	// 	print(*current, s, format, out);
 	// 	next();
 	// }
 
-	// std::cout << std::endl;
-	for(stmt * s : statement_seq())
-	{
-		std::cout << s->evaluate() << std::endl;
-	}
+	return statement_seq();
 }
 
 // decl*
@@ -161,19 +649,27 @@ void parser::parse(std::string s, output_format format)
 std::vector<stmt *>
 parser::statement_seq()
 {
-	std::cout << "statement_seq" << std::endl;
-	std::vector<stmt*> statements;
+	trace_rule("statement_seq");
+
+	// Kept in seq, so the statements before an error can still be evaluated
+	seq.clear();
 	while (!empty())
 	{
-		statements.push_back(statement());
+		// Skip empty statements and comments between statements
+		if(match_if(token_kind::semicolon) || match_if(token_kind::comment_literal))
+		{
+			continue;
+		}
+
+		seq.push_back(statement());
 	}
-	return statements;
+	return seq;
 }
 
 stmt *
 parser::statement()
 {
-	std::cout << "statement" << std::endl;
+	trace_rule("statement");
 	switch (lookahead())
 	{
 		case token_kind::variable_literal:
@@ -186,15 +682,20 @@ parser::statement()
 stmt*
 parser::declaration_statement()
 {
-	std::cout << "declaration_statement" << std::endl;
-	return new decl_stmt(declaration());
+	trace_rule("declaration_statement");
+	return arn.make<decl_stmt>(declaration());
 }
 
 stmt*
 parser::expression_statement()
 {
-	std::cout << "expression_statement" << std::endl;
-	stmt * s = new expr_stmt(expression());
+	trace_rule("expression_statement");
+	expr * e = optimize(expression());
+	if(deferring)
+	{
+		deferred.push_back(lazy->add(e));
+	}
+	stmt * s = arn.make<expr_stmt>(e, sharing ? & memo : nullptr, forking.get());
 	match(token_kind::semicolon);
 	return s;
 }
@@ -206,7 +707,7 @@ parser::expression_statement()
 decl*
 parser::declaration()
 {
-	std::cout << "declaration" << std::endl;
+	trace_rule("declaration");
 	switch(lookahead())
 	{
 		case token_kind::variable_literal:
@@ -219,16 +720,30 @@ parser::declaration()
 decl*
 parser::variable_declaration()
 {
-	std::cout << "variable_declaration" << std::endl;
+	trace_rule("variable_declaration");
 
-	type * t = type_specifier();
-	std::string * n = identifier();
-	var_decl * v = new var_decl(t, n);
-	match(token_kind::equals);
-	v->e = expression();
+	// var [type] name = e, without a type the variable takes the type of e
+	match(token_kind::variable_literal);
+	type * t = nullptr;
+	if(lookahead() == token_kind::bool_keyword || lookahead() == token_kind::int_keyword)
+	{
+		t = type_specifier();
+	}
+	unsigned n = identifier();
+	if(!match(token_kind::equals))
+	{
+		throw std::exception("Expected '=' in variable declaration");
+	}
+	expr * e = optimize(expression());
 	match(token_kind::semicolon);
 
-	return v;
+	if(t != nullptr && t != e->t)
+	{
+		throw std::exception("Initializer does not match the declared type");
+	}
+
+	// Bound after the initializer, which still sees a previous declaration
+	return arn.make<var_decl>(e->t, e, declare(n, e), & values, sharing ? & memo : nullptr);
 }
 
 // -------------------------------------------------------------------------- //
@@ -237,7 +752,7 @@ parser::variable_declaration()
 type*
 parser::type_specifier()
 {
-	std::cout << "type_specifier" << std::endl;
+	trace_rule("type_specifier");
 	return simple_type_specifier();
 }
 
@@ -245,16 +760,20 @@ parser::type_specifier()
 type*
 parser::simple_type_specifier()
 {
-	std::cout << "simple_type_specifier" << std::endl;
+	trace_rule("simple_type_specifier");
 	switch(lookahead())
 	{
-		case token_kind::bool_literal:
+		case token_kind::bool_keyword:
 			consume();
-			return & ctx->bool_type;
-		case token_kind::int_literal:
+			return & types().bool_type;
+		case token_kind::int_keyword:
 			consume();
-			return & ctx->int_type;
+			return & types().int_type;
+		default:
+			break;
 	}
+
+	throw std::exception("Expected a type");
 }
 
 // -------------------------------------------------------------------------- //
@@ -263,13 +782,13 @@ parser::simple_type_specifier()
 expr*
 parser::expression()
 {
-	std::cout << "expression" << std::endl;
+	trace_rule("expression");
 	return conditional_expression();
 }
 
 expr * parser::conditional_expression()
 {
-	std::cout << "conditional_expression" << std::endl;
+	trace_rule("conditional_expression");
 	expr * e1 = logical_or_expression();
 
 	while(true)
@@ -279,7 +798,7 @@ expr * parser::conditional_expression()
 			expr * e2 = logical_or_expression();
 			match(token_kind::colon);
 			expr * e3 = logical_or_expression();
-			e1 = new cond_expr(e1, e2, e3);
+			e1 = make<cond_expr>(e1, e2, e3);
 		}
 		else
 		{
@@ -292,7 +811,7 @@ expr * parser::conditional_expression()
 
 expr * parser::logical_or_expression()
 {
-	std::cout << "logical_or_expression" << std::endl;
+	trace_rule("logical_or_expression");
 	expr * e1 = logical_and_expression();
 
 	while(true)
@@ -300,12 +819,12 @@ expr * parser::logical_or_expression()
 		if(match_if(token_kind::bar))
 		{
 			expr * e2 = logical_and_expression();
-			e1 = new or_expr(e1, e2);
+			e1 = make<or_expr>(e1, e2);
 		}
 		else if(match_if(token_kind::bar_bar))
 		{
 			expr * e2 = logical_and_expression();
-			e1 = new or_else_expr(e1, e2);
+			e1 = make<or_else_expr>(e1, e2);
 		}
 		else
 		{
@@ -319,7 +838,7 @@ expr * parser::logical_or_expression()
 
 expr * parser::logical_and_expression()
 {
-	std::cout << "logical_and_expression" << std::endl;
+	trace_rule("logical_and_expression");
 	expr * e1 = equality_expression();
 
 	while(true)
@@ -327,12 +846,12 @@ expr * parser::logical_and_expression()
 		if(match_if(token_kind::ampersand))
 		{
 			expr * e2 = equality_expression();
-			e1 = new and_expr(e1, e2);
+			e1 = make<and_expr>(e1, e2);
 		}
 		else if (match_if(token_kind::ampersand_ampersand))
 		{
 			expr * e2 = equality_expression();
-			e1 = new and_then_expr(e1, e2);
+			e1 = make<and_then_expr>(e1, e2);
 		}
 		else
 		{
@@ -346,7 +865,7 @@ expr * parser::logical_and_expression()
 
 expr * parser::equality_expression()
 {
-	std::cout << "equality_expression" << std::endl;
+	trace_rule("equality_expression");
 	expr * e1 = ordering_expression();
 
 	while(true)
@@ -354,12 +873,12 @@ expr * parser::equality_expression()
 		if(match_if(token_kind::equal_equal))
 		{
 			expr * e2 = ordering_expression();
-			e1 = new equal_expr(e1, e2);
+			e1 = make<equal_expr>(e1, e2);
 		}
 		else if (match_if(token_kind::exclamation_equal))
 		{
 			expr * e2 = ordering_expression();
-			e1 = new not_equal_expr(e1, e2);
+			e1 = make<not_equal_expr>(e1, e2);
 		}
 		else
 		{
@@ -373,7 +892,7 @@ expr * parser::equality_expression()
 
 expr * parser::ordering_expression()
 {
-	std::cout << "ordering_expression" << std::endl;
+	trace_rule("ordering_expression");
 	expr * e1 = additive_expression();
 
 	while(true)
@@ -381,22 +900,22 @@ expr * parser::ordering_expression()
 		if(match_if(token_kind::less_than))
 		{
 			expr * e2 = additive_expression();
-			e1 = new less_than_expr(e1, e2);
+			e1 = make<less_than_expr>(e1, e2);
 		}
 		else if(match_if(token_kind::less_than_equal))
 		{
 			expr * e2 = additive_expression();
-			e1 = new less_than_eq_expr(e1, e2);
+			e1 = make<less_than_eq_expr>(e1, e2);
 		}
 		else if(match_if(token_kind::greater_than))
 		{
 			expr * e2 = additive_expression();
-			e1 = new greater_than_expr(e1, e2);
+			e1 = make<greater_than_expr>(e1, e2);
 		}
 		else if(match_if(token_kind::greater_than_equal))
 		{
 			expr * e2 = additive_expression();
-			e1 = new greater_than_eq_expr(e1, e2);
+			e1 = make<greater_than_eq_expr>(e1, e2);
 		}
 		else
 		{
@@ -412,7 +931,7 @@ expr * parser::ordering_expression()
 expr*
 parser::additive_expression()
 {
-	std::cout << "additive_expression" << std::endl;
+	trace_rule("additive_expression");
 	expr * e1 = multiplicative_expression();
 
 	while(true)
@@ -420,12 +939,12 @@ parser::additive_expression()
 		if(match_if(token_kind::plus))
 		{
 			expr * e2 = multiplicative_expression();
-			e1 = new add_expr(e1, e2);
+			e1 = make<add_expr>(e1, e2);
 		}
 		else if (match_if(token_kind::minus))
 		{
 			expr * e2 = multiplicative_expression();
-			e1 = new sub_expr(e1, e2);
+			e1 = make<sub_expr>(e1, e2);
 		}
 		else
 		{
@@ -440,7 +959,7 @@ parser::additive_expression()
 expr*
 parser::multiplicative_expression()
 {
-	std::cout << "multiplicative_expression" << std::endl;
+	trace_rule("multiplicative_expression");
 	expr * e1 = unary_expression();
 	
 	while(true)
@@ -448,17 +967,17 @@ parser::multiplicative_expression()
 		if(match_if(token_kind::asterisk))
 		{
 			expr * e2 = unary_expression();
-			e1 = new multi_expr(e1, e2);
+			e1 = make<multi_expr>(e1, e2);
 		}
 		else if (match_if(token_kind::forward_slash))
 		{
 			expr * e2 = unary_expression();
-			e1 = new div_expr(e1, e2);
+			e1 = make<div_expr>(e1, e2);
 		}
 		else if (match_if(token_kind::percent))
 		{
 			expr * e2 = unary_expression();
-			e1 = new rem_expr(e1, e2);
+			e1 = make<rem_expr>(e1, e2);
 		}
 		else
 		{
@@ -473,10 +992,14 @@ parser::multiplicative_expression()
 expr*
 parser::unary_expression()
 {
-	std::cout << "unary_expression" << std::endl;
+	trace_rule("unary_expression");
 	if(match_if(token_kind::minus))
 	{		
-		return new neg_expr(unary_expression());
+		return make<neg_expr>(unary_expression());
+	}
+	else if(match_if(token_kind::exclamation))
+	{
+		return make<not_expr>(unary_expression());
 	}
 	else
 	{
@@ -487,14 +1010,16 @@ parser::unary_expression()
 expr*
 parser::primary_expression()
 {
-	std::cout << "primary_expression, kind: " << token_kind_strs[(*current)->kind] << std::endl;
+	trace_rule("primary_expression");
 	expr * e;
 	switch(lookahead())
 	{
 		case token_kind::bool_literal:
-			return new bool_expr(static_cast<bool_token *>(consume())->val);
+			return make<bool_expr>(consume()->val != 0);
 		case token_kind::int_literal:
-			return new int_expr(static_cast<int_token *>(consume())->val);
+		case token_kind::binary_literal:
+		case token_kind::hex_literal:
+			return make<int_expr>(consume()->val);
 		case token_kind::identifier:
 			return id_expression();
 		case token_kind::open_parenthesis:
@@ -505,26 +1030,70 @@ parser::primary_expression()
 		default:
 			break;
 	}
+
+	throw std::exception("Expected an expression");
 }
 
 expr*
 parser::id_expression()
 {
-	std::cout << "id_expression" << std::endl;
-	std::string * s = identifier();
-	decl * d = sym_tbl->find(*s);
-	var_decl * v = 
-	return nullptr;
+	trace_rule("id_expression");
+	symbol * s = sym_tbl.find(identifier());
+	if(s == nullptr)
+	{
+		throw std::exception("Undeclared identifier");
+	}
+	if(deferring)
+	{
+		lazy->refer(s->slot);
+	}
+
+	return make<ref_expr>(s->t, s->slot, & values);
 }
 
 // -------------------------------------------------------------------------- //
 // Identifiers
 
-std::string *
+// Returns the interned id of the identifier
+unsigned
 parser::identifier()
 {
-	std::cout << "identitfier" << std::endl;
-	token * temp = match(token_kind::identifier);
-	id_token * t = static_cast<id_token *>(temp);
-	return & t->val;
+	trace_rule("identifier");
+	token * t = match(token_kind::identifier);
+	if(t == nullptr)
+	{
+		throw std::exception("Expected an identifier");
+	}
+	return static_cast<unsigned>(t->val);
+}
+
+// Binds name to a slot of the value array for the value of e and returns
+// its index
+// A name has one slot per type, so redeclaring a variable with the same
+// type keeps its slot, and so does parsing the declaration again
+// Deferred, every declaration is a thunk with a slot of its own
+// The array itself grows when the declaration is evaluated
+int
+parser::declare(unsigned name, expr * e)
+{
+	symbol & s = sym_tbl[name];
+	type * t = e->t;
+	if(deferring)
+	{
+		s = { t, lazy->add(e) };
+		++epoch;
+	}
+	else if(s.t != t)
+	{
+		int slot = homes.emplace(std::make_pair(name, t), static_cast<int>(homes.size())).first->second;
+		if(log != nullptr)
+		{
+			log->push_back(binding{ name, s, symbol{ t, slot } });
+		}
+		s = { t, slot };
+		++epoch;
+	}
+	return s.slot;
 }
+
+#endif
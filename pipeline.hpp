@@ -0,0 +1,273 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+# include <atomic>
+# include <cstddef>
+# include <cstdio>
+# include <exception>
+# include <memory>
+# include <string>
+# include <thread>
+# include <vector>
+
+# include "lexer.hpp"
+# include "parser.hpp"
+# include "ast/token.hpp"
+# include "com/arena.hpp"
+# include "com/interner.hpp"
+# include "com/ring.hpp"
+# include "com/writer.hpp"
+
+// *************************************************************************** //
+// Pipeline class
+//
+// Summary:
+//		- Runs lexing, parsing, evaluation and output as four stages on
+//			four threads, so while one block of input is being evaluated
+//			the next is being parsed and the one after that lexed.
+//		- Work moves between the stages in batches of whole lines read in
+//			blocks of about 64 KiB. A fixed set of batches circulates from
+//			the lexer through each stage and back, over lock free single
+//			producer single consumer rings. When every batch is in flight
+//			the lexer waits for the output stage to return one, so a slow
+//			stage holds back reading instead of letting input pile up.
+//		- Each batch owns the arena its statements were built in. The
+//			parser hands its arena over after every batch, so the parser can
+//			run ahead while the statements of earlier batches are still
+//			being evaluated.
+//		- The lexer stage interns names with its own interner. The parser
+//			only ever sees the ids, so the two never share a table.
+//		- Results are written in input order. An error stops the reading;
+//			the statements of its batch before it are still evaluated, and
+//			run() rethrows it after their results have been written.
+//
+// *************************************************************************** //
+class pipeline
+{
+private:
+	struct batch
+	{
+		std::string text;
+		std::vector<token> tokens;
+		arena nodes;
+		std::vector<stmt *> statements;
+		std::vector<long long> results;
+		std::exception_ptr error;
+		bool last;
+	};
+
+	static const std::size_t depth = 8;
+	static const std::size_t block_size = 64 * 1024;
+
+	interner names;
+	lexer lxr;
+	parser prsr;
+	writer out;
+	std::unique_ptr<batch[]> batches;
+
+	// free returns batches from the output stage to the lexer
+	spsc_ring<batch *, depth> free;
+	spsc_ring<batch *, depth> lexed;
+	spsc_ring<batch *, depth> parsed;
+	spsc_ring<batch *, depth> evaluated;
+
+	std::atomic<bool> stop;
+	std::exception_ptr error;
+
+	void lex_stage(std::FILE *);
+	void parse_stage();
+	void eval_stage();
+	void output_stage();
+
+public:
+	pipeline(std::FILE * file = stdout) : lxr(& names), out(file), batches(new batch[depth]), stop(false) { }
+
+	pipeline(const pipeline &) = delete;
+	pipeline & operator=(const pipeline &) = delete;
+
+	// The parser of the parse and evaluation stages, to set its options
+	parser & syntax() { return prsr; }
+
+	void run(std::FILE *);
+};
+
+// Reads in until it ends or a later stage fails, then sends the last batch
+void pipeline::lex_stage(std::FILE * in)
+{
+	std::string carry;
+	bool more = true;
+
+	while(more && !stop)
+	{
+		batch * b = free.pop();
+		b->text.swap(carry);
+		carry.clear();
+
+		// Read blocks until the text holds a newline or the input ends
+		std::size_t n;
+		do
+		{
+			std::size_t size = b->text.size();
+			b->text.resize(size + block_size);
+			n = std::fread(& b->text[size], 1, block_size, in);
+			b->text.resize(size + n);
+		}
+		while(n == block_size && b->text.find('\n', b->text.size() - n) == std::string::npos);
+
+		// A partial last line waits for the next batch
+		more = n == block_size;
+		if(more)
+		{
+			std::size_t nl = b->text.rfind('\n');
+			carry.assign(b->text, nl + 1, std::string::npos);
+			b->text.resize(nl + 1);
+		}
+
+		try
+		{
+			lxr.lex(b->text, b->tokens);
+		}
+		catch(...)
+		{
+			// The statements before the error are still parsed
+			parser::trim(b->tokens);
+			b->error = std::current_exception();
+		}
+		lexed.push(b);
+	}
+
+	batch * b = free.pop();
+	b->last = true;
+	lexed.push(b);
+}
+
+void pipeline::parse_stage()
+{
+	bool failed = false;
+
+	while(true)
+	{
+		batch * b = lexed.pop();
+		if(!b->last && !failed)
+		{
+			// A parse error comes before any lexer error of the batch, and
+			// the statements before it are still evaluated
+			try
+			{
+				b->statements = prsr.parse_tokens(b->tokens);
+			}
+			catch(...)
+			{
+				b->statements = prsr.parsed();
+				b->error = std::current_exception();
+			}
+			prsr.hand_over(b->nodes);
+		}
+		failed = failed || b->error;
+
+		parsed.push(b);
+		if(b->last)
+		{
+			return;
+		}
+	}
+}
+
+void pipeline::eval_stage()
+{
+	bool failed = false;
+
+	while(true)
+	{
+		batch * b = parsed.pop();
+		if(!b->last && !failed)
+		{
+			// An evaluation error comes before the batch's other errors
+			try
+			{
+				for(stmt * s : b->statements)
+				{
+					b->results.push_back(s->evaluate());
+				}
+			}
+			catch(...)
+			{
+				b->error = std::current_exception();
+			}
+		}
+		failed = failed || b->error;
+
+		evaluated.push(b);
+		if(b->last)
+		{
+			return;
+		}
+	}
+}
+
+// Writes the results of each batch and returns it to the lexer
+void pipeline::output_stage()
+{
+	while(true)
+	{
+		batch * b = evaluated.pop();
+		if(b->last)
+		{
+			out.flush();
+			return;
+		}
+
+		if(!error)
+		{
+			for(long long val : b->results)
+			{
+				out.put_int(val);
+				out.put('\n');
+			}
+
+			if(b->error)
+			{
+				error = b->error;
+				stop = true;
+			}
+		}
+
+		b->statements.clear();
+		b->results.clear();
+		b->error = nullptr;
+		free.push(b);
+	}
+}
+
+// Parses and evaluates everything read from in
+void pipeline::run(std::FILE * in)
+{
+	stop = false;
+	error = nullptr;
+	for(std::size_t i = 0; i < depth; ++i)
+	{
+		batches[i].last = false;
+		free.push(& batches[i]);
+	}
+
+	std::thread parse(& pipeline::parse_stage, this);
+	std::thread evaluate(& pipeline::eval_stage, this);
+	std::thread output(& pipeline::output_stage, this);
+
+	lex_stage(in);
+
+	parse.join();
+	evaluate.join();
+	output.join();
+
+	// The last batch never went back to the free ring
+	batch * b;
+	while(free.try_pop(b)) { }
+
+	if(error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+#endif
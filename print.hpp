@@ -2,9 +2,9 @@
 #ifndef PRINT_HPP
 #define PRINT_HPP
 
+# include <string_view>
 # include "ast/token.hpp"
-
-static char buffer [33];
+# include "com/writer.hpp"
 
 enum output_format
 {
@@ -26,51 +26,35 @@ static int getNumberBase(output_format format)
 	}
 }
 
-void print(token * t, output_format format)
+void print(const token & t, std::string_view src, output_format format, writer & out)
 {
-	class vis : public token::visitor
-	{
-	public:
-		output_format format;
-
-		vis(output_format format) : format(format) { }
+	out.put(token_kind_strs[t.kind]);
 
-		void visit(op_token * tok) 
-		{
-			std::cout << token_kind_strs[tok->kind] << std::endl;
-		}
-		void visit(bool_token * tok) 
-		{
-			std::cout << token_kind_strs[tok->kind] << " : " << (tok->val ? "TRUE" : "FALSE") << std::endl;
-		}
-		void visit(int_token * tok) 
-		{
-			std::cout << token_kind_strs[tok->kind] << " : " << itoa(tok->val, buffer, getNumberBase(format)) << std::endl;
-		}
-		void visit(binary_token * tok) 
-		{
-			std::cout << token_kind_strs[tok->kind] << " : " << itoa(tok->val, buffer, getNumberBase(format)) << std::endl;
-		}
-		void visit(hex_token * tok) 
-		{
-			std::cout << token_kind_strs[tok->kind] << " : " << itoa(tok->val, buffer, getNumberBase(format)) << std::endl;
-		}
-		void visit(comment_token * tok) 
-		{
-			std::cout << token_kind_strs[tok->kind] << " : " << tok->val << std::endl;
-		}
-		void visit(id_token * tok) 
-		{
-			std::cout << token_kind_strs[tok->kind] << " : " << tok->val << std::endl;
-		}
-		void visit(var_token * tok) 
-		{
-			std::cout << token_kind_strs[tok->kind] << " : var" << std::endl;
-		}
-	};
+	switch(t.kind)
+	{
+		case bool_literal:
+			out.put(" : ");
+			out.put(t.val ? "TRUE" : "FALSE");
+			break;
+		case int_literal:
+		case binary_literal:
+		case hex_literal:
+			out.put(" : ");
+			out.put_int(t.val, getNumberBase(format));
+			break;
+		case comment_literal:
+		case identifier:
+			out.put(" : ");
+			out.put(src.substr(t.pos, t.len));
+			break;
+		case variable_literal:
+			out.put(" : var");
+			break;
+		default:
+			break;
+	}
 
-	vis v(format);
-	t->accept(v);	
+	out.put('\n');
 }
 
 #endif
@@ -0,0 +1,250 @@
+#ifndef STREAM_HPP
+#define STREAM_HPP
+
+# include <climits>
+# include <cstddef>
+# include <cstdint>
+# include <cstring>
+# include <string_view>
+# include <vector>
+
+# include "lexer.hpp"
+# include "ast/token.hpp"
+# include "com/interner.hpp"
+# include "com/writer.hpp"
+
+// *************************************************************************** //
+// Token streams
+//
+// Summary:
+//		- write_tokens() stores what the lexer made of a text: one byte of
+//			kind per token, the value of each literal and identifier in a
+//			separate array, and the identifier names. A parser replays the
+//			stream without running the character level lexer again, so a
+//			changed grammar can be tried on a large input that has not.
+//		- Identifiers are numbered in the stream by first use. Replaying
+//			interns the names into the parser's own interner, so a stream
+//			can be replayed into a parser that has already seen other text.
+//		- Token positions are not stored. The parser only reads the ids of
+//			identifiers, so replayed tokens have none.
+//		- token_stream reads a mapped file in place after checking its
+//			magic, version and sizes, and that each identifier has a name.
+//
+// *************************************************************************** //
+
+const std::uint32_t stream_version = 1;
+
+struct stream_header
+{
+	char magic[4];
+	std::uint32_t version;
+	std::uint32_t tokens;
+	std::uint32_t payloads;
+	std::uint32_t names;
+	std::uint32_t name_bytes;
+};
+
+static_assert(sizeof(stream_header) == 24, "stream_header must have the same layout on every compiler");
+
+static const char stream_magic[4] = { 'U', 'T', 'O', 'K' };
+
+// True if tokens of kind k carry a value
+bool has_payload(token_kind k)
+{
+	return k == bool_literal || k == int_literal || k == binary_literal || k == hex_literal || k == identifier;
+}
+
+// Lexes text and writes its tokens as a stream
+void write_tokens(std::string_view text, writer & out)
+{
+	interner names;
+	lexer lxr(& names);
+	std::vector<token> tokens;
+	lxr.lex(text, tokens);
+
+	// Renumber identifiers by first use in this text
+	std::vector<std::uint32_t> ids(names.size(), UINT32_MAX);
+	std::vector<std::uint32_t> ends;
+	std::string blob;
+
+	std::vector<unsigned char> kinds;
+	std::vector<long long> payloads;
+	kinds.reserve(tokens.size());
+
+	for(token & t : tokens)
+	{
+		kinds.push_back(static_cast<unsigned char>(t.kind));
+		if(!has_payload(t.kind))
+		{
+			continue;
+		}
+
+		long long val = t.val;
+		if(t.kind == identifier)
+		{
+			std::uint32_t & id = ids[static_cast<std::size_t>(t.val)];
+			if(id == UINT32_MAX)
+			{
+				id = static_cast<std::uint32_t>(ends.size());
+				blob += names.name(static_cast<unsigned>(t.val));
+				ends.push_back(static_cast<std::uint32_t>(blob.size()));
+			}
+			val = id;
+		}
+		payloads.push_back(val);
+	}
+
+	stream_header h = { { stream_magic[0], stream_magic[1], stream_magic[2], stream_magic[3] }, stream_version,
+		static_cast<std::uint32_t>(kinds.size()), static_cast<std::uint32_t>(payloads.size()),
+		static_cast<std::uint32_t>(ends.size()), static_cast<std::uint32_t>(blob.size()) };
+	out.put(std::string_view(reinterpret_cast<const char *>(& h), sizeof(h)));
+	out.put(std::string_view(reinterpret_cast<const char *>(payloads.data()), payloads.size() * sizeof(long long)));
+	out.put(std::string_view(reinterpret_cast<const char *>(ends.data()), ends.size() * sizeof(std::uint32_t)));
+	out.put(std::string_view(reinterpret_cast<const char *>(kinds.data()), kinds.size()));
+	out.put(blob);
+}
+
+// *************************************************************************** //
+// Token stream class
+//
+// Summary:
+//		- A checked view of a token stream held in memory, usually a
+//			mapped_file. The bytes must stay valid and 8 byte aligned
+//			while it is used.
+//		- read() expands the stream into tokens a block at a time, so a
+//			large stream is parsed in pieces like a large text file.
+//
+// *************************************************************************** //
+class token_stream
+{
+public:
+	// Position of the next token to read and of its payload
+	struct cursor
+	{
+		std::size_t token;
+		std::size_t payload;
+	};
+
+private:
+	const stream_header * header;
+	const long long * payloads;
+	const std::uint32_t * ends;
+	const unsigned char * kinds;
+	const char * blob;
+
+public:
+	token_stream(std::string_view);
+
+	std::size_t size() const { return header->tokens; }
+
+	std::vector<unsigned> bind(interner &) const;
+	bool read(cursor &, std::size_t, const std::vector<unsigned> &, std::vector<token> &) const;
+};
+
+token_stream::token_stream(std::string_view bytes)
+{
+	if(bytes.size() < sizeof(stream_header) || reinterpret_cast<std::size_t>(bytes.data()) % alignof(long long) != 0)
+	{
+		throw std::exception("Not a token stream");
+	}
+
+	header = reinterpret_cast<const stream_header *>(bytes.data());
+	if(std::memcmp(header->magic, stream_magic, sizeof(stream_magic)) != 0)
+	{
+		throw std::exception("Not a token stream");
+	}
+	if(header->version != stream_version)
+	{
+		throw std::exception("Unsupported token stream version");
+	}
+
+	std::size_t size = sizeof(stream_header) + header->payloads * sizeof(long long)
+		+ header->names * sizeof(std::uint32_t) + header->tokens + header->name_bytes;
+	if(bytes.size() != size)
+	{
+		throw std::exception("Truncated token stream");
+	}
+
+	payloads = reinterpret_cast<const long long *>(bytes.data() + sizeof(stream_header));
+	ends = reinterpret_cast<const std::uint32_t *>(payloads + header->payloads);
+	kinds = reinterpret_cast<const unsigned char *>(ends + header->names);
+	blob = reinterpret_cast<const char *>(kinds + header->tokens);
+
+	// Names must follow each other inside the blob
+	for(std::size_t i = 0; i < header->names; ++i)
+	{
+		if(ends[i] > header->name_bytes || (i > 0 && ends[i] < ends[i - 1]))
+		{
+			throw std::exception("Corrupt token stream");
+		}
+	}
+
+	std::size_t p = 0;
+	for(std::size_t i = 0; i < header->tokens; ++i)
+	{
+		token_kind k = static_cast<token_kind>(kinds[i]);
+		if(k > identifier)
+		{
+			throw std::exception("Corrupt token stream");
+		}
+		if(has_payload(k))
+		{
+			if(p == header->payloads || (k == identifier && (payloads[p] < 0 || payloads[p] >= header->names)))
+			{
+				throw std::exception("Corrupt token stream");
+			}
+			++p;
+		}
+	}
+	if(p != header->payloads)
+	{
+		throw std::exception("Corrupt token stream");
+	}
+}
+
+// Returns the id in names of each of the stream's identifiers
+std::vector<unsigned> token_stream::bind(interner & names) const
+{
+	std::vector<unsigned> ids(header->names);
+	for(std::size_t i = 0; i < ids.size(); ++i)
+	{
+		std::uint32_t start = i == 0 ? 0 : ends[i - 1];
+		ids[i] = names.intern(std::string_view(blob + start, ends[i] - start));
+	}
+	return ids;
+}
+
+// Reads about n tokens from at into out, replacing its contents
+// A block ends after a semicolon so no statement is split; identifiers get
+// their ids from bind(). Returns false once the stream is exhausted
+bool token_stream::read(cursor & at, std::size_t n, const std::vector<unsigned> & ids, std::vector<token> & out) const
+{
+	out.clear();
+	if(at.token == header->tokens)
+	{
+		return false;
+	}
+
+	while(at.token < header->tokens)
+	{
+		token_kind k = static_cast<token_kind>(kinds[at.token++]);
+		token t(k, 0, 0);
+		if(has_payload(k))
+		{
+			t.val = payloads[at.payload++];
+			if(k == identifier)
+			{
+				t.val = ids[static_cast<std::size_t>(t.val)];
+			}
+		}
+		out.push_back(t);
+
+		if(k == semicolon && out.size() >= n)
+		{
+			break;
+		}
+	}
+	return true;
+}
+
+#endif